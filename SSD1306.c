@@ -22,9 +22,9 @@ All text above, and the splash screen below must be included in any redistributi
 #include "timer.h"
 #include "SSD1306.h"
 #include "swi2c.h"
+#include "i2c.h"
 
 #include "lcd.h"
-#include "tui.h"
 
 /* This unused blob of splash screen apparently has to remain here, because
  * this code was forked before it was moved into a splash.h header in the
@@ -102,28 +102,86 @@ static uint8_t buffer[SSD1306_LCDHEIGHT * SSD1306_LCDWIDTH / 8] = {
 };
 */
 
+#ifdef SSD1306_HWI2C
+/* The OLED is on the hardware TWI (PC4/PC5) with the RTC, the writes are queued to the TWI ISR. */
+#define oled_start(a) i2c_tx_begin(a)
+#define oled_write(d) i2c_tx_byte(d)
+#define oled_stop() i2c_tx_end()
+#define oled_bus_init() do { } while(0)
+#else
+#define oled_start(a) swi2c_start(a)
+#define oled_write(d) swi2c_write(d)
+#define oled_stop() swi2c_stop()
+#define oled_bus_init() swi2c_init()
+#endif
+
 static uint8_t oled_present = 1;
+static uint16_t oled_stats[SSD1306_STATS];
 
-void ssd1306_command(uint8_t c) {
-	if (!oled_present)
-		return;
-	if (swi2c_start(SSD1306_I2C_ADDRESS)) {
-		oled_present = 0;
-		return;
+/* What we have told the controller, ssd1306_init puts it back after a power loss. */
+static uint8_t oled_contrast = SSD1306_DEF_CONTRAST;
+static uint8_t oled_comscan = SSD1306_COMSCANDEC;
+static uint8_t oled_segremap = SSD1306_SEGREMAP | 0x1;
+
+/* A NAK of the address is a missing display (or a mangled address), a bus error or
+ * a NAK after the address is noise. Either way the whole transaction is tried again,
+ * and only after OLED_TRIES failures in a row do we consider the display gone. */
+#define OLED_TRIES 3
+
+static void ssd1306_fail(uint8_t r) {
+	if (r == 2) {
+		oled_stats[SSD1306_S_NAK]++;
+	} else {
+		oled_stats[SSD1306_S_ERR]++;
+		if (r == 1) oled_stop(); /* release the bus after a timeout */
 	}
-	if (swi2c_write(0x00)) //  control; Co = 0, D/C = 0
-		return;
-	if (swi2c_write(c))
-		return;
-	swi2c_stop();
 }
 
-static void ssd1306_seq(const uint8_t * cmd, uint8_t n) {
+static void ssd1306_lost(void) {
+	oled_present = 0;
+	oled_stats[SSD1306_S_LOST]++;
+}
+
+/* Returns 0 or per swi2c_start(), with errors after the start reported as 3. */
+static uint8_t ssd1306_try(uint8_t ctrl, const uint8_t *cmd, uint8_t n) {
+	uint8_t r = oled_start(SSD1306_I2C_ADDRESS);
+	if (r)
+		return r;
+	if (oled_write(ctrl))
+		return 3;
 	for (uint8_t i=0;i<n;i++) {
-		ssd1306_command(cmd[i]);
+		if (oled_write(cmd[i]))
+			return 3;
+	}
+	return 0;
+}
+
+/* Sends n command bytes in a single transaction (Co = 0 means the rest is all commands). */
+void ssd1306_commands(const uint8_t *cmd, uint8_t n) {
+	if (!oled_present)
+		return;
+	for (uint8_t t=0;t<OLED_TRIES;t++) {
+		uint8_t r = ssd1306_try(0x00, cmd, n); //  control; Co = 0, D/C = 0
+		if (!r) {
+			oled_stop();
+			return;
+		}
+		ssd1306_fail(r);
 	}
+	ssd1306_lost();
+}
+
+void ssd1306_command(uint8_t c) {
+	ssd1306_commands(&c, 1);
+}
+
+void ssd1306_contrast(uint8_t c) {
+	oled_contrast = c;
+	uint8_t cmd[2] = { SSD1306_SETCONTRAST, c };
+	ssd1306_commands(cmd, 2);
 }
 
+/* Also used to bring back a display that was lost, so the contrast and flip are what we last set. */
 void ssd1306_init(void) {
 	const uint8_t init_seq[] = {
 		SSD1306_DISPLAYOFF,                   // 0xAE
@@ -140,27 +198,27 @@ void ssd1306_init(void) {
 		0x14,
 
 		SSD1306_MEMORYMODE,                    // 0x20
-		0x00,                                  // 0x0 act like ks0108
-		SSD1306_SEGREMAP | 0x1,
-		SSD1306_COMSCANDEC,
+		0x01,                                  // vertical, lcd.c streams columns
+		oled_segremap,
+		oled_comscan,
 
 #if defined SSD1306_128_32
 		SSD1306_SETCOMPINS,                    // 0xDA
 		0x02,
 		SSD1306_SETCONTRAST,                   // 0x81
-		0x8F,
+		oled_contrast,
 
 #elif defined SSD1306_128_64
 		SSD1306_SETCOMPINS,                    // 0xDA
 		0x12,
 		SSD1306_SETCONTRAST,                   // 0x81
-		0xCF,
+		oled_contrast,
 
 #elif defined SSD1306_96_16
 		SSD1306_SETCOMPINS,                    // 0xDA
 		0x2,   //ada x12
 		SSD1306_SETCONTRAST,                   // 0x81
-		0xAF,
+		oled_contrast,
 
 #endif
 
@@ -172,7 +230,7 @@ void ssd1306_init(void) {
 		SSD1306_NORMALDISPLAY,                 // 0xA6
 		SSD1306_DEACTIVATE_SCROLL
 	};
-	ssd1306_seq(init_seq, sizeof(init_seq));
+	ssd1306_commands(init_seq, sizeof(init_seq));
 }
 
 void ssd1306_flip(uint8_t com, uint8_t seg) {
@@ -180,51 +238,87 @@ void ssd1306_flip(uint8_t com, uint8_t seg) {
 	uint8_t sc = SSD1306_SEGREMAP | 0x1;
 	if (com) cc = SSD1306_COMSCANINC;
 	if (seg) sc = SSD1306_SEGREMAP;
-	ssd1306_command(cc);
-	ssd1306_command(sc);
+	oled_comscan = cc;
+	oled_segremap = sc;
+	uint8_t cmd[2] = { cc, sc };
+	ssd1306_commands(cmd, 2);
 }
 
-static void ssd1306_addr(uint8_t t, uint8_t b, uint8_t l) {
-	ssd1306_command(t);
-	ssd1306_command(b);
-	ssd1306_command((b+l)-1);
+/* Moves the contents of pages y0-y1, columns x0-x1 one column to the left (as seen with the
+ * display flip state), the rightmost column is left as is. Needs 2ms before the next one. */
+void ssd1306_scroll_left(uint8_t y0, uint8_t y1, uint8_t x0, uint8_t x1)
+{
+	uint8_t cmd[7] = {
+		(oled_segremap & 0x1) ? SSD1306_RIGHT_CONTENT_SCROLL : SSD1306_LEFT_CONTENT_SCROLL,
+		0x00, y0, 0x01, y1, x0, x1
+	};
+	ssd1306_commands(cmd, 7);
 }
 
 void ssd1306_setbox(uint8_t x, uint8_t y, uint8_t w, uint8_t h) /* This is the hardware gotoxy */
 {
-	ssd1306_addr(SSD1306_COLUMNADDR, x, w);
-	ssd1306_addr(SSD1306_PAGEADDR, y, h);
+	uint8_t cmd[6] = {
+		SSD1306_COLUMNADDR, x, (x+w)-1,
+		SSD1306_PAGEADDR, y, (y+h)-1
+	};
+	ssd1306_commands(cmd, 6);
 }
 
 uint8_t ssd1306_start(void) {
 	if (!oled_present)
 		return 1;
-	if (swi2c_start(SSD1306_I2C_ADDRESS)) return 1;
-	if (swi2c_write(0x40)) return 1;
-	return 0;
+	for (uint8_t t=0;t<OLED_TRIES;t++) {
+		uint8_t r = ssd1306_try(0x40, NULL, 0);
+		if (!r)
+			return 0;
+		ssd1306_fail(r);
+	}
+	ssd1306_lost();
+	return 1;
 }
 
-
-
+/* A failure here can't be retried since the position in the box is gone, lcd.c
+ * redraws what was lost. */
 uint8_t ssd1306_data(uint8_t d) {
-	return swi2c_write(d);
+	if (oled_write(d)) {
+		oled_stats[SSD1306_S_ERR]++;
+		return 1;
+	}
+	return 0;
 }
 
 void ssd1306_end(void) {
-	swi2c_stop();
+	oled_stop();
 }
 
+uint8_t ssd1306_present(void) {
+	return oled_present;
+}
+
+uint16_t ssd1306_stat(uint8_t st) {
+	return oled_stats[st];
+}
 
+/* Look for a lost display. It has probably been power cycled, so lcd_resync
+ * sets it up again and has the TUI redraw it. */
 void ssd1306_run(void) {
-	if (timer_get_1hzp()) {
-		if (!oled_present) {
-			if (swi2c_start(SSD1306_I2C_ADDRESS)==0) {
-				swi2c_stop();
-				swi2c_init();
-				oled_present = 1;
-				lcd_init();
-				tui_activate();
-			}
-		}
+	if (oled_present) {
+		/* Nothing might be drawn for a while, so an empty command transaction
+		 * once a second notices the display going away. Not while it is off,
+		 * lcd_idle sets it up again when it comes back on. */
+		if (timer_get_1hzp() && lcd_is_on()) ssd1306_commands(NULL, 0);
+		return;
+	}
+	if (!timer_get_5hzp())
+		return;
+	uint8_t r = oled_start(SSD1306_I2C_ADDRESS);
+	if (r) {
+		if (r == 1) oled_stop();
+		return;
 	}
+	oled_stop();
+	oled_bus_init();
+	oled_present = 1;
+	oled_stats[SSD1306_S_RESYNC]++;
+	lcd_resync();
 }
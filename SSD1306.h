@@ -50,15 +50,20 @@ All text above, and the splash screen must be included in any redistribution
 #if defined SSD1306_128_64
   #define SSD1306_LCDWIDTH                  128
   #define SSD1306_LCDHEIGHT                 64
+  #define SSD1306_DEF_CONTRAST              0xCF
 #endif
 #if defined SSD1306_128_32
   #define SSD1306_LCDWIDTH                  128
   #define SSD1306_LCDHEIGHT                 32
+  #define SSD1306_DEF_CONTRAST              0x8F
 #endif
 #if defined SSD1306_96_16
   #define SSD1306_LCDWIDTH                  96
   #define SSD1306_LCDHEIGHT                 16
+  #define SSD1306_DEF_CONTRAST              0xAF
 #endif
+/* Contrast for the dimmed (nobody is looking) state */
+#define SSD1306_DIM_CONTRAST 0x08
 
 #define SSD1306_SETCONTRAST 0x81
 #define SSD1306_DISPLAYALLON_RESUME 0xA4
@@ -105,16 +110,31 @@ All text above, and the splash screen must be included in any redistribution
 #define SSD1306_LEFT_HORIZONTAL_SCROLL 0x27
 #define SSD1306_VERTICAL_AND_RIGHT_HORIZONTAL_SCROLL 0x29
 #define SSD1306_VERTICAL_AND_LEFT_HORIZONTAL_SCROLL 0x2A
+// One column content scroll, not in the older datasheets (and some clones)
+#define SSD1306_RIGHT_CONTENT_SCROLL 0x2C
+#define SSD1306_LEFT_CONTENT_SCROLL 0x2D
 
 
 void ssd1306_command(uint8_t c);
+void ssd1306_commands(const uint8_t *cmd, uint8_t n);
+void ssd1306_contrast(uint8_t c);
 void ssd1306_init(void);
 void ssd1306_setbox(uint8_t x, uint8_t y, uint8_t w, uint8_t h);
 uint8_t ssd1306_start(void);
 uint8_t ssd1306_data(uint8_t d);
 void ssd1306_end(void);
 void ssd1306_flip(uint8_t com, uint8_t seg);
+void ssd1306_scroll_left(uint8_t y0, uint8_t y1, uint8_t x0, uint8_t x1);
 
 void ssd1306_run(void);
+uint8_t ssd1306_present(void);
+
+/* Error counters, ssd1306_stat */
+#define SSD1306_S_NAK 0 /* address not acked */
+#define SSD1306_S_ERR 1 /* bus error or NAK after the address */
+#define SSD1306_S_LOST 2 /* gave up retrying, display considered gone */
+#define SSD1306_S_RESYNC 3 /* display found again and set up */
+#define SSD1306_STATS 4
+uint16_t ssd1306_stat(uint8_t st);
 
 
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include "main.h"
+#include "sensor.h"
+#include "adcsensor.h"
+
+/* An ADC channel as a "sensor", in mV with AVcc (5V) as the reference.
+ * The ADC is only powered for the conversion. */
+#define ADC_VREF_MV 5000UL
+
+static void adc_init(uint8_t ch)
+{
+	if (ch < 6) DIDR0 |= _BV(ch); /* 6 and 7 are analog only */
+}
+
+static uint16_t adc_start(uint8_t ch)
+{
+	ADMUX = _BV(REFS0) | (ch & 7);
+	/* 125 kHz ADC clock, the first conversion after enable takes 25 of them. */
+	ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	return 1;
+}
+
+static uint16_t adc_poll(uint8_t ch)
+{
+	(void)ch;
+	if (ADCSRA & _BV(ADSC)) return 1;
+	return 0;
+}
+
+static uint8_t adc_read(uint8_t ch, int16_t *v)
+{
+	(void)ch;
+	uint16_t r = ADC;
+	ADCSRA = 0;
+	v[0] = (r * ADC_VREF_MV) / 1024;
+	return SENSOR_OK;
+}
+
+static const char adc_u0[] PROGMEM = "U[mV]";
+
+const struct sensor_ops adc_ops PROGMEM = {
+	.init = adc_init,
+	.start = adc_start,
+	.poll = adc_poll,
+	.read = adc_read,
+	.units = { adc_u0, NULL },
+	.nvals = 1,
+	.scale = 0,
+	.interval = 1,
+	.vmin = { 0, 0 },
+	.vmax = { ADC_VREF_MV, 0 },
+	.vdelta = { ADC_VREF_MV, 0 },
+};
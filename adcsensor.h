@@ -0,0 +1,4 @@
+#pragma once
+#include "sensor.h"
+
+extern const struct sensor_ops adc_ops;
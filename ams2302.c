@@ -1,145 +1,166 @@
 #include "main.h"
 #include "timer.h"
+#include "sensor.h"
 #include "ams2302.h"
+#include "uart.h"
 
-#define DHTPIN PINB
-#define DHTPRT PORTB
-#define DHTDDR DDRB
-#define DHTBIT 0
+/* AMS2302 (DHT22) driver. On PB0 the falling edges are timestamped by Timer1 input capture (ICP1),
+ * on other pins by a pin change interrupt reading TCNT1, which is a few us worse but still
+ * well inside the bit timing margins. */
+#define AMS_ICP_PIN SENSOR_PB(0)
 
-static uint8_t ams_data[5];
-static uint32_t ams_timestamp;
-static PGM_P ams_err;
+/* Falling edges: the response, the start of the first bit and the end of each of the 40 bits.
+ * A 0 bit is 76-78us between falling edges and a 1 bit is 120us. */
+#define AMS_EDGES 42
+#define AMS_BIT_THRESHOLD (100*T1_TICKS_PER_US)
+#define AMS_TIMEOUT (6000*T1_TICKS_PER_US)
+#define AMS_START_PULSE (1100*T1_TICKS_PER_US)
 
-static void dhtpulse(void)
+static volatile uint8_t ams_ic_edges;
+static uint16_t ams_ic_last;
+static uint8_t ams_ic_data[5];
+static uint16_t ams_ic_start;
+static uint8_t ams_pin;
+static volatile uint8_t *ams_pcint_pin;
+static uint8_t ams_pcint_mask;
+
+static inline void ams_edge(uint16_t t) __attribute__((always_inline));
+static inline void ams_edge(uint16_t t)
 {
-	DHTPRT |=  _BV(DHTBIT);
-	_delay_us(1);
-	DHTDDR |=  _BV(DHTBIT);
-	DHTPRT &= ~_BV(DHTBIT);
-	_delay_ms(1.1);
-	DHTPRT |=  _BV(DHTBIT);
-	DHTDDR &= ~_BV(DHTBIT);
-	_delay_us(10);
+	uint16_t d = t - ams_ic_last;
+	ams_ic_last = t;
+	uint8_t e = ams_ic_edges;
+	ams_ic_edges = e + 1;
+	if (e < 2) return;
+	e -= 2;
+	if (e >= 40) return;
+	uint8_t *p = &(ams_ic_data[e >> 3]);
+	*p = (*p << 1) | (d >= AMS_BIT_THRESHOLD);
 }
 
-static int8_t dhtbit(void)
+ISR(TIMER1_CAPT_vect)
 {
-	uint8_t n, t, v;
-	uint8_t b = timer_get_lin_us();
-	n = b; /* In case of already zero */
-	/* Wait for zero */
-	while (DHTPIN & _BV(DHTBIT)) {
-		n = timer_get_lin_us();
-		t = n - b;
-		if (t >= 100) return -1;
-	};
-	b = n;
-	/* Wait for one */
-	do {
-		n = timer_get_lin_us();
-		t = n - b;
-		if (t >= 127) return -2;
-	} while (!(DHTPIN & _BV(DHTBIT)));
-	/* Wait for zero */
-	b = n;
-	do {
-		n = timer_get_lin_us();
-		v = n - b;
-		if (v >= 200) return -3;
-	} while (DHTPIN & _BV(DHTBIT));
-	if (v > 50) return 1;
-	return 0;
+	ams_edge(ICR1);
 }
 
-static PGM_P ams_read(void) {
-	uint8_t dat[5];
-	dhtpulse();
-	if (dhtbit() < 0) {
-		return PSTR("No response");
-	}
-	for (uint8_t n=0; n < 5; n++) {
-		uint8_t d = 0;
-		for (uint8_t i=0; i < 8; i++) {
-			int8_t b = dhtbit();
-			if (b < 0) {
-				return PSTR("RX Failed");
-			}
-			d = d << 1;
-			d |= b;
-		}
-		dat[n] = d;
-	}
-	uint8_t sum = dat[0] + dat[1] + dat[2] + dat[3];
-	if (sum != dat[4]) {
-		return PSTR("Checksum failure");
-	}
-	memcpy(ams_data, dat, 5);
-	ams_timestamp = timer_get();
-	return NULL;
-/*	
-	uint16_t temp = (dat[2] << 8) | dat[3];
-	uint16_t rh = (dat[0] << 8) | dat[1];
-	sendstr_P(PSTR("Temp: "));
-	luint2outdual(temp);
-	sendstr_P(PSTR("\r\nRH: "));
-	luint2outdual(rh); */
+ISR(PCINT0_vect)
+{
+	uint16_t t = TCNT1;
+	if ((ams_pcint_mask)&&(!(*ams_pcint_pin & ams_pcint_mask))) ams_edge(t);
 }
-	
 
-void ams_run(void) {
-	if ( (timer_get_1hzp()) && ( (timer_get() & 1) == 1) ) {
-		ams_err = ams_read();
-	}
-}
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
 
-void ams_init(void) {
-	ams_err = PSTR("Too early");
-	DHTPRT |= _BV(DHTBIT);
+/* Port D is shared with the auto-baud timing of RXD (PCINT16) in uart.c, which
+ * only takes the edges of its own pin. */
+ISR(PCINT2_vect)
+{
+	uint16_t t = TCNT1;
+	uart_ab_edge(t);
+	if ((ams_pcint_mask)&&(!(*ams_pcint_pin & ams_pcint_mask))) ams_edge(t);
 }
 
-PGM_P ams_get(int16_t *tempC10, uint16_t *rh10, uint8_t max_age)
+static void ams_irq_off(uint8_t pin)
 {
-	uint32_t age = timer_get() - ams_timestamp;
-	if ((!ams_timestamp)||(age > max_age)) return ams_err ? ams_err : PSTR("Too old");
-	
-	if (tempC10) {
-		uint16_t wtemp = (ams_data[2] << 8) | ams_data[3];
-		int16_t stemp = wtemp;
-		if (wtemp & 0x8000) stemp = -(wtemp & 0x7FFF);
-		*tempC10 = stemp;
-	}
-	
-	if (rh10) {
-		uint16_t rhv = (ams_data[0] << 8) | ams_data[1];
-		*rh10 = rhv;
+	TIMSK1 &= ~_BV(OCIE1A);
+	if (pin == AMS_ICP_PIN) {
+		TIMSK1 &= ~_BV(ICIE1);
+	} else {
+		uint8_t pi = pin >> 3;
+		cli();
+		ams_pcint_mask = 0;
+		(&PCMSK0)[pi] &= ~SENSOR_PINMASK(pin);
+		if (!(&PCMSK0)[pi]) PCICR &= ~_BV(pi);
+		sei();
 	}
+}
 
-	return NULL;
+static void ams_init(uint8_t pin)
+{
+	*SENSOR_PORTREG(pin) |= SENSOR_PINMASK(pin);
 }
 
-void make_v10_str(unsigned char*buf, int16_t t10) 
+/* The end of the 1.1ms start pulse: arm the edge timestamping and let go of the line. */
+ISR(TIMER1_COMPA_vect)
 {
-	uint16_t v10;
-	if (t10 < 0) {
-		*buf++ = '-';
-		v10 = -t10;
+	uint8_t pin = ams_pin;
+	uint8_t m = SENSOR_PINMASK(pin);
+	TIMSK1 &= ~_BV(OCIE1A);
+	ams_ic_edges = 0;
+	if (pin == AMS_ICP_PIN) {
+		TCCR1B &= ~_BV(ICES1);
+		TIFR1 = _BV(ICF1);
+		TIMSK1 |= _BV(ICIE1);
 	} else {
-		v10 = t10;
+		uint8_t pi = pin >> 3;
+		ams_pcint_pin = SENSOR_PINREG(pin);
+		ams_pcint_mask = m;
+		(&PCMSK0)[pi] |= m;
+		PCIFR = _BV(pi);
+		PCICR |= _BV(pi);
 	}
-	uint8_t ldig = v10 % 10;
-	uint16_t pv = v10 / 10;
-	if (v10 >= 1000) {
-		*buf++ = 0x30 | (pv / 100);
-		pv = pv % 100;
-	}
-	if (v10 >= 100) {
-		*buf++ = 0x30 | (pv / 10);
-		pv = pv % 10;
-	}
-	*buf++ = 0x30 | pv;
-	*buf++ = '.';
-	*buf++ = 0x30 | ldig;
-	*buf = 0;
+	*SENSOR_PORTREG(pin) |= m;
+	*SENSOR_DDRREG(pin) &= ~m;
+	ams_ic_start = OCR1A;
+}
+
+static uint16_t ams_start(uint8_t pin)
+{
+	volatile uint8_t *port = SENSOR_PORTREG(pin);
+	volatile uint8_t *ddr = SENSOR_DDRREG(pin);
+	uint8_t m = SENSOR_PINMASK(pin);
+	ams_pin = pin;
+	ams_ic_edges = 0;
+	ams_ic_start = TCNT1;
+	cli();
+	*ddr |= m;
+	*port &= ~m;
+	OCR1A = TCNT1 + AMS_START_PULSE;
+	TIFR1 = _BV(OCF1A);
+	TIMSK1 |= _BV(OCIE1A);
+	sei();
+	/* The pulse and the ~5ms transfer. */
+	return 7;
+}
+
+static uint16_t ams_poll(uint8_t pin)
+{
+	if (TIMSK1 & _BV(OCIE1A)) return 1; /* Still in the start pulse. */
+	if ((ams_ic_edges < AMS_EDGES) && ((uint16_t)(TCNT1 - ams_ic_start) < AMS_TIMEOUT)) return 1;
+	ams_irq_off(pin);
+	return 0;
 }
 
+static uint8_t ams_read(uint8_t pin, int16_t *v)
+{
+	uint8_t *dat = ams_ic_data;
+	ams_irq_off(pin);
+	uint8_t edges = ams_ic_edges;
+	if (!edges) return SENSOR_E_NORESP;
+	if (edges < AMS_EDGES) return SENSOR_E_RXFAIL;
+	uint8_t sum = dat[0] + dat[1] + dat[2] + dat[3];
+	if (sum != dat[4]) return SENSOR_E_CSUM;
+	uint16_t wtemp = (dat[2] << 8) | dat[3];
+	int16_t temp = wtemp;
+	if (wtemp & 0x8000) temp = -(wtemp & 0x7FFF);
+	v[0] = temp;
+	v[1] = (dat[0] << 8) | dat[1];
+	return SENSOR_OK;
+}
+
+static const char ams_u0[] PROGMEM = "T[C]";
+static const char ams_u1[] PROGMEM = "RH[%]";
+
+const struct sensor_ops ams2302_ops PROGMEM = {
+	.init = ams_init,
+	.start = ams_start,
+	.poll = ams_poll,
+	.read = ams_read,
+	.units = { ams_u0, ams_u1 },
+	.nvals = 2,
+	.scale = 1,
+	.interval = 2, /* The sensor wants atleast 2s between reads. */
+	.vmin = { -400, 0 },
+	.vmax = { 800, 1000 },
+	.vdelta = { 50, 100 },
+};
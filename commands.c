@@ -1,5 +1,6 @@
 #include "main.h"
 #include "swi2c.h"
+#include "i2c.h"
 #include "uart.h"
 #include "console.h"
 #include "lib.h"
@@ -9,11 +10,11 @@
 #include "timer.h"
 #include "buttons.h"
 #include "sd_raw.h"
-#include "partition.h"
-#include "fat.h"
 //#include "RCSwitch.h"
 #include "rcminitx.h"
-#include "ams2302.h"
+#include "sensor.h"
+#include "logger.h"
+#include "config.h"
 
 
 CIFACE_APP(lcd_cmd, "LCDINIT")
@@ -36,38 +37,146 @@ CIFACE_APP(swi2c_scan_cmd, "SWI2CSCAN")
 	} while (a);	
 }
 
-CIFACE_APP(btns_cmd, "BTNS")
+CIFACE_APP(i2cstat_cmd, "I2CSTAT")
 {
-	do {
-		uint8_t v = buttons_get();
-		PGM_P btn = PSTR("BUTTON_");
-		switch (v) {
-			default:
-				sendstr_P(btn);
-				sendstr_P(PSTR("UNKNOWN"));
-				break;
-			case BUTTON_S1:
-				sendstr_P(btn);
-				sendstr_P(PSTR("S1"));
-				break;
-			case BUTTON_S2:
-				sendstr_P(btn);
-				sendstr_P(PSTR("S2"));
-				break;
-			case BUTTON_NONE:
-				if (token_count == 1) {
-					sendstr_P(btn);
-					sendstr_P(PSTR("NONE"));
-				}
-				break;
-			case BUTTON_BOTH:
-				sendstr_P(btn);
-				sendstr_P(PSTR("BOTH"));
-				break;
+	sendstr_P(PSTR("OK: "));
+	luint2outdual(i2c_stat(I2C_X_OK));
+	sendstr_P(PSTR("\r\nNAK: "));
+	luint2outdual(i2c_stat(I2C_X_NAK));
+	sendstr_P(PSTR("\r\nERR: "));
+	luint2outdual(i2c_stat(I2C_X_ERR));
+	sendstr_P(PSTR("\r\nOLED NAK: "));
+	luint2outdual(ssd1306_stat(SSD1306_S_NAK));
+	sendstr_P(PSTR("\r\nOLED ERR: "));
+	luint2outdual(ssd1306_stat(SSD1306_S_ERR));
+	sendstr_P(PSTR("\r\nOLED LOST: "));
+	luint2outdual(ssd1306_stat(SSD1306_S_LOST));
+	sendstr_P(PSTR("\r\nOLED RESYNC: "));
+	luint2outdual(ssd1306_stat(SSD1306_S_RESYNC));
+}
+
+static void sendnum(uint32_t v)
+{
+	unsigned char buf[11];
+	luint2str(buf, v);
+	sendstr(buf);
+}
+
+/* The new rate has to be confirmed with a CR at it, otherwise we go back. */
+#define BAUD_CONFIRM_MS 5000
+
+struct baud_task {
+	uint32_t start;
+	uint32_t baud;
+	uint8_t ok;
+};
+
+/* BAUD AUTO: the 'U' is timed in the background, see uart_autobaud_poll. */
+static uint8_t autobaud_step(void *ctx)
+{
+	struct baud_task *t = ctx;
+	t->baud = uart_autobaud_poll();
+	if (t->baud) return TASK_DONE;
+	if ((timer_get() - t->start) > BAUD_CONFIRM_MS/1000)
+		return TASK_DONE;
+	return TASK_WAIT;
+}
+
+/* The host has BAUD_CONFIRM_MS to send a CR at the new rate, anything else is ignored. */
+static uint8_t baud_step(void *ctx)
+{
+	struct baud_task *t = ctx;
+	while (uart_isdata()) {
+		if (RECEIVE() == '\r') {
+			t->ok = 1;
+			return TASK_DONE;
 		}
-		if (v != BUTTON_NONE) token_count = 1;
-		cli_bgloop();
-	} while (token_count > 1);
+	}
+	if ((timer_get() - t->start) > BAUD_CONFIRM_MS/1000)
+		return TASK_DONE;
+	return TASK_WAIT;
+}
+
+/* BAUD <rate> or BAUD AUTO (the host then sends a 'U' at its rate, up to 115200,
+ * again until it gets an answer) */
+CIFACE_APP(baud_cmd, "BAUD")
+{
+	uint32_t old = uart_get_baud();
+	uint32_t baud;
+	struct baud_task t = { timer_get(), 0, 0 };
+	if (token_count < 2) {
+		sendnum(old);
+		return;
+	}
+	if (strcmp_P((char*)tokenptrs[1], PSTR("AUTO")) == 0) {
+		sendstr_P(PSTR("SEND U\r\n"));
+		uart_wait_txdone();
+		uart_autobaud_start();
+		task_exec(autobaud_step, &t);
+		uart_autobaud_stop();
+		baud = t.baud;
+		if (!baud) {
+			sendstr_P(PSTR("NO SYNC"));
+			return;
+		}
+		uart_set_baud(baud);
+		sendstr_P(PSTR("OK "));
+		sendnum(baud);
+	} else {
+		baud = strtoul((char*)tokenptrs[1], NULL, 10);
+		if (!uart_baud_ok(baud)) {
+			sendstr_P(PSTR("ERR BAUD"));
+			return;
+		}
+		sendstr_P(PSTR("OK "));
+		sendnum(baud);
+		uart_set_baud(baud);
+	}
+	t.start = timer_get();
+	task_exec(baud_step, &t);
+	if (t.ok) return;
+	uart_set_baud(old);
+	sendstr_P(PSTR("\r\nBAUD TIMEOUT"));
+}
+
+/* ctx: keep going until a button is pressed */
+static uint8_t btns_step(void *ctx)
+{
+	uint8_t *wait = ctx;
+	uint8_t v = buttons_get();
+	PGM_P btn = PSTR("BUTTON_");
+	switch (v) {
+		default:
+			sendstr_P(btn);
+			sendstr_P(PSTR("UNKNOWN"));
+			break;
+		case BUTTON_S1:
+			sendstr_P(btn);
+			sendstr_P(PSTR("S1"));
+			break;
+		case BUTTON_S2:
+			sendstr_P(btn);
+			sendstr_P(PSTR("S2"));
+			break;
+		case BUTTON_NONE:
+			if (!*wait) {
+				sendstr_P(btn);
+				sendstr_P(PSTR("NONE"));
+			}
+			break;
+		case BUTTON_BOTH:
+			sendstr_P(btn);
+			sendstr_P(PSTR("BOTH"));
+			break;
+	}
+	if (v != BUTTON_NONE) *wait = 0;
+	return *wait ? TASK_WAIT : TASK_DONE;
+}
+
+CIFACE_APP(btns_cmd, "BTNS")
+{
+	uint8_t wait = token_count > 1;
+	task_exec(btns_step, &wait);
 }
 
 CIFACE_APP(timer_cmd, "TIMER")
@@ -75,14 +184,11 @@ CIFACE_APP(timer_cmd, "TIMER")
 	luint2outdual(timer_get());
 }
 
-static uint8_t sd_initialized = 0;
 static uint8_t sd_init(void) {
 	if (!sd_raw_init()) {
-		sd_initialized = 0;
 		sendstr_P(PSTR("init failed"));
 		return 0;
 	}
-	sd_initialized = 1;
 	return 1;
 }
 
@@ -98,70 +204,6 @@ CIFACE_APP(sdtest_cmd, "SDTEST")
 	luint2outdual(info.capacity / (1024UL*1024));
 }
 
-CIFACE_APP(fattest_cmd, "FATTEST")
-{
-	if (!sd_initialized) {
-		if (!sd_init()) return;
-	}
-	struct partition_struct part;
-        struct partition_struct* partition = 
-		partition_open(sd_raw_read,
-			sd_raw_read_interval,
-			sd_raw_write,
-			sd_raw_write_interval,
-			0, &part);
-        if(!partition) {
-		/* try superfloppy mode */
-		partition = partition_open(sd_raw_read,
-                                       sd_raw_read_interval,
-                                       sd_raw_write,
-                                       sd_raw_write_interval,
-                                       -1, &part
-                                      );
-		if(!partition) {
-			sendstr_P(PSTR("opening partition failed"));
-			return;
-		}
-        }
-
-        /* open file system */
-	struct fat_fs_struct fat;
-        struct fat_fs_struct* fs = fat_open(partition, &fat);
-        if(!fs) {
-		sendstr_P(PSTR("opening filesystem failed"));
-		goto err_partition;
-        }
-
-        /* open root directory */
-	struct fat_dir_struct d_in;
-        struct fat_dir_entry_struct directory;
-        fat_get_dir_entry_of_path(fs, "/", &directory);
-
-        struct fat_dir_struct* dd = fat_open_dir(fs, &directory, &d_in);
-        if(!dd) {
-		sendstr_P(PSTR("opening root directory failed"));
-		goto err_fat;
-        }
-
-	struct fat_dir_entry_struct dir_entry;
-	while(fat_read_dir(dd, &dir_entry))
-	{
-		uint8_t spaces = sizeof(dir_entry.long_name) - strlen(dir_entry.long_name) + 4;
-		sendstr((unsigned char*)dir_entry.long_name);
-		SEND(dir_entry.attributes & FAT_ATTRIB_DIR ? '/' : ' ');
-		while(spaces--) SEND(' ');
-		luint2outdual(dir_entry.file_size);
-		sendstr_P(PSTR("\r\n"));
-	}
-        
-        fat_close_dir(dd);
-err_fat:
-        fat_close(fs);
-err_partition:
-        partition_close(partition);
-		
-}
-
 #if 0
 //CIKFACE_APP(rcs_rx_cmd, "RCRX")
 {
@@ -190,6 +232,25 @@ err_partition:
 }
 #endif
 
+struct rctx_task {
+	uint8_t code[5];
+	uint8_t rep;
+};
+
+/* The receiver wants the repeats back to back, each one ended by the sync gap,
+ * so a burst of them (about 80ms each) goes out in one step. */
+#define RCTX_BURST 5
+
+static uint8_t rctx_step(void *ctx)
+{
+	struct rctx_task *t = ctx;
+	uint8_t n = t->rep < RCTX_BURST ? t->rep : RCTX_BURST;
+	rcminitx(t->code, 40, n);
+	t->rep -= n;
+	return t->rep ? TASK_MORE : TASK_DONE;
+}
+
+/* RCTX [code [repeats]] */
 CIFACE_APP(rcs_tx_cmd, "RCTX")
 {
 	/* Buttons: On  Off
@@ -197,33 +258,109 @@ CIFACE_APP(rcs_tx_cmd, "RCTX")
 	 * 2,3,4 in some order: 4, 2, C (and their inversions)
 	 * All      10  5
 	 */
-	uint8_t base[5] = { 0x20, 0x1D, 0xDF, 0xE2, 0x00 };
+	struct rctx_task t = { { 0x20, 0x1D, 0xDF, 0xE2, 0x00 }, 5 };
 	uint8_t code = 7;
-	if (token_count == 2) code = atoi((char*)tokenptrs[1]);
-	if (code > 15) return;
+	if (token_count >= 2) code = atoi((char*)tokenptrs[1]);
+	if (token_count >= 3) t.rep = atoi((char*)tokenptrs[2]);
+	if ((code > 15)||(!t.rep)) return;
 	sendstr_P(PSTR("Sending code "));
 	luint2outdual(code);
-	base[4] = (code << 4) | (code ^ 0xF);
-	rcminitx(base, 40, 5);
+	t.code[4] = (code << 4) | (code ^ 0xF);
+	task_exec(rctx_step, &t);
 }
 
 
 CIFACE_APP(tempread_cmd, "THQ")
 {
-	unsigned char v10s[8];
-	int16_t temp10;
-	uint16_t rh10;
-	
-	PGM_P r = ams_get(&temp10, &rh10, 5);
-	if (r) {
-		sendstr_P(r);
+	for (uint8_t i=0; i < sensor_count(); i++) {
+		unsigned char vs[8];
+		int16_t v[SENSOR_MAXVALS];
+		if (i) sendstr_P(PSTR("\r\n"));
+		SEND('S');
+		SEND('0' + i);
+		sendstr_P(PSTR(": "));
+		PGM_P r = sensor_get(i, v, cfg.sensor_max_age);
+		if (r) {
+			sendstr_P(r);
+			continue;
+		}
+		for (uint8_t vi=0; vi < sensor_nvals(i); vi++) {
+			sendstr_P(sensor_units(i, vi));
+			SEND('=');
+			sensor_val_str(vs, v[vi], sensor_scale(i));
+			sendstr(vs);
+			SEND(' ');
+		}
+		sendstr_P(PSTR("Q:"));
+		SEND(sensor_quality(i));
+	}
+}
+
+CIFACE_APP(senstat_cmd, "SENSTAT")
+{
+	for (uint8_t i=0; i < sensor_count(); i++) {
+		if (i) sendstr_P(PSTR("\r\n"));
+		SEND('S');
+		SEND('0' + i);
+		SEND(':');
+		for (uint8_t st=0; st < SENSOR_STATS; st++) {
+			sendstr_P(PSTR("\r\n "));
+			sendstr_P(sensor_stat_name(st));
+			sendstr_P(PSTR(": "));
+			luint2outdual(sensor_stat(i, st));
+		}
+	}
+}
+
+static void cfg_show(uint8_t i)
+{
+	unsigned char buf[13];
+	sendstr_P(cfg_name(i));
+	SEND('=');
+	cfg_str(i, buf);
+	sendstr(buf);
+}
+
+/* CFG			list the settings
+ * CFG NAME [value]	show or change one, in RAM until saved
+ * CFG SAVE|LOAD|DEFAULTS	write to or reread the EEPROM, or go back to the defaults */
+CIFACE_APP(cfg_cmd, "CFG")
+{
+	char log_name[sizeof(cfg.log_name)];
+	if (token_count < 2) {
+		for (uint8_t i=0; i < cfg_count(); i++) {
+			if (i) sendstr_P(PSTR("\r\n"));
+			cfg_show(i);
+		}
 		return;
 	}
-	sendstr_P(PSTR("Temp: "));
-	make_v10_str(v10s, temp10);
-	sendstr(v10s);
-	sendstr_P(PSTR(" *C\r\nRH: "));
-	make_v10_str(v10s, rh10);
-	sendstr(v10s);
-	sendstr_P(PSTR("%"));
-}
\ No newline at end of file
+	char *name = (char*)tokenptrs[1];
+	strcpy(log_name, cfg.log_name);
+	if (!strcmp_P(name, PSTR("SAVE"))) {
+		cfg_save();
+	} else if (!strcmp_P(name, PSTR("LOAD"))) {
+		cfg_init();
+	} else if (!strcmp_P(name, PSTR("DEFAULTS"))) {
+		cfg_defaults();
+	} else {
+		uint8_t i = cfg_find(name);
+		if (i == 255) {
+			sendstr_P(PSTR("ERR NAME"));
+			return;
+		}
+		if (token_count > 2) {
+			if (cfg_parse(i, (char*)tokenptrs[2])) {
+				sendstr_P(PSTR("ERR VALUE"));
+				return;
+			}
+		}
+		cfg_show(i);
+		name = NULL;
+	}
+	/* A new log file name needs the card mounted again. */
+	if (strcmp(log_name, cfg.log_name)) {
+		logger_sd_eject(1);
+		logger_sd_eject(0);
+	}
+	if (name) sendstr_P(PSTR("OK"));
+}
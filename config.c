@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* The EEPROM copy of struct config: a header and then the struct as it was when it
+ * was saved. The CRC covers len bytes of it. Fields are only added at the end of the
+ * struct, so a store from an older firmware (shorter len) keeps its values and the
+ * new fields get their defaults; CFG_VERSION is bumped when an existing field changes
+ * meaning or size, and that throws the old store away. Out of range values are also
+ * replaced by the defaults, item by item. */
+
+#include "main.h"
+#include "lib.h"
+#include "config.h"
+#include <util/crc16.h>
+#include <stddef.h>
+
+#define CFG_VERSION 1
+
+struct cfg_header {
+	uint8_t version;
+	uint8_t len;
+	uint16_t crc;
+};
+
+struct cfg_store {
+	struct cfg_header h;
+	struct config c;
+};
+
+static struct cfg_store EEMEM cfg_ee;
+
+struct config cfg;
+
+static const struct config cfg_default PROGMEM = {
+	.log_interval = 300,
+	.log_flush = 256,
+	.idle_timeout = 600,
+	.dim_timeout = 60,
+	.nonrtc_valid = 6*60,
+	.tui_refresh = 5,
+	.sensor_max_age = 5,
+	.log_name = "DATALOG.TXT",
+};
+
+struct cfg_item {
+	PGM_P name;
+	uint8_t off;
+	uint8_t type;
+	uint16_t min;
+	uint16_t max;
+};
+
+#define CFG(n, f, t, mi, ma) const unsigned char cfg_n_##f[] PROGMEM = n;
+CFG_ITEMS
+#undef CFG
+
+static const struct cfg_item cfg_items[] PROGMEM = {
+#define CFG(n, f, t, mi, ma) { (PGM_P)cfg_n_##f, offsetof(struct config, f), t, mi, ma },
+	CFG_ITEMS
+#undef CFG
+};
+
+#define CFG_COUNT (sizeof(cfg_items)/sizeof(cfg_items[0]))
+
+static uint16_t cfg_crc(const void *p, uint8_t len)
+{
+	const uint8_t *b = p;
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i=0; i < len; i++) crc = _crc16_update(crc, b[i]);
+	return crc;
+}
+
+uint8_t cfg_count(void)
+{
+	return CFG_COUNT;
+}
+
+PGM_P cfg_name(uint8_t i)
+{
+	return (PGM_P)pgm_read_word(&(cfg_items[i].name));
+}
+
+uint8_t cfg_type(uint8_t i)
+{
+	return pgm_read_byte(&(cfg_items[i].type));
+}
+
+uint16_t cfg_min(uint8_t i)
+{
+	return pgm_read_word(&(cfg_items[i].min));
+}
+
+uint16_t cfg_max(uint8_t i)
+{
+	return pgm_read_word(&(cfg_items[i].max));
+}
+
+static uint8_t *cfg_ptr(uint8_t i)
+{
+	return (uint8_t*)&cfg + pgm_read_byte(&(cfg_items[i].off));
+}
+
+uint8_t cfg_find(const char *name)
+{
+	for (uint8_t i=0; i < CFG_COUNT; i++) {
+		if (!strcmp_P(name, cfg_name(i))) return i;
+	}
+	return 255;
+}
+
+uint16_t cfg_get(uint8_t i)
+{
+	uint8_t *p = cfg_ptr(i);
+	switch (cfg_type(i)) {
+		case CFG_U8:
+			return *p;
+		case CFG_U16:
+			return *(uint16_t*)p;
+	}
+	return 0;
+}
+
+void cfg_set(uint8_t i, uint16_t v)
+{
+	uint8_t *p = cfg_ptr(i);
+	switch (cfg_type(i)) {
+		case CFG_U8:
+			*p = v;
+			break;
+		case CFG_U16:
+			*(uint16_t*)p = v;
+			break;
+	}
+}
+
+/* An 8.3 name: 1-8 characters, and optionally a dot and 1-3 more.
+ * Not .IDX, logger.c uses that for the index of the log. */
+static uint8_t cfg_name83(char *s)
+{
+	char *e = strchr(s, '.');
+	if ((e)&&(!strcasecmp_P(e, PSTR(".IDX")))) return 1;
+	uint8_t n = 0, ext = 0;
+	for (; *s; s++) {
+		*s = toupper(*s);
+		if (*s == '.') {
+			if ((ext)||(!n)) return 1;
+			ext = 1;
+			n = 0;
+			continue;
+		}
+		if ((!isalnum(*s))&&(*s != '_')&&(*s != '-')) return 1;
+		if (++n > (ext ? 3 : 8)) return 1;
+	}
+	return !n;
+}
+
+static uint8_t cfg_valid(uint8_t i)
+{
+	if (cfg_type(i) == CFG_STR) {
+		char *s = (char*)cfg_ptr(i);
+		s[cfg_max(i) - 1] = 0;
+		return !cfg_name83(s);
+	}
+	uint16_t v = cfg_get(i);
+	return (v >= cfg_min(i))&&(v <= cfg_max(i));
+}
+
+uint8_t cfg_parse(uint8_t i, const char *s)
+{
+	if (cfg_type(i) == CFG_STR) {
+		char buf[13];
+		if (strlen(s) >= cfg_max(i)) return 1;
+		strcpy(buf, s);
+		if (cfg_name83(buf)) return 1;
+		strcpy((char*)cfg_ptr(i), buf);
+		return 0;
+	}
+	char *e;
+	uint32_t v = strtoul(s, &e, 10);
+	if ((!*s)||(*e)||(v < cfg_min(i))||(v > cfg_max(i))) return 1;
+	cfg_set(i, v);
+	return 0;
+}
+
+void cfg_str(uint8_t i, unsigned char *buf)
+{
+	if (cfg_type(i) == CFG_STR) strcpy((char*)buf, (char*)cfg_ptr(i));
+	else uint2str(buf, cfg_get(i));
+}
+
+void cfg_defaults(void)
+{
+	memcpy_P(&cfg, &cfg_default, sizeof(struct config));
+}
+
+void cfg_init(void)
+{
+	struct cfg_header h;
+	struct config c;
+	cfg_defaults();
+	eeprom_read_block(&h, &cfg_ee.h, sizeof(struct cfg_header));
+	if ((h.version != CFG_VERSION)||(!h.len)||(h.len > sizeof(struct config))) return;
+	eeprom_read_block(&c, &cfg_ee.c, h.len);
+	if (cfg_crc(&c, h.len) != h.crc) return;
+	memcpy(&cfg, &c, h.len);
+	for (uint8_t i=0; i < CFG_COUNT; i++) {
+		if (cfg_valid(i)) continue;
+		uint8_t off = pgm_read_byte(&(cfg_items[i].off));
+		uint8_t sz = cfg_type(i) == CFG_STR ? cfg_max(i) : cfg_type(i) == CFG_U16 ? 2 : 1;
+		memcpy_P(cfg_ptr(i), (const uint8_t*)&cfg_default + off, sz);
+	}
+}
+
+/* eeprom_update_block only writes the bytes that changed. */
+void cfg_save(void)
+{
+	struct cfg_header h;
+	h.version = CFG_VERSION;
+	h.len = sizeof(struct config);
+	h.crc = cfg_crc(&cfg, sizeof(struct config));
+	eeprom_update_block(&cfg, &cfg_ee.c, sizeof(struct config));
+	eeprom_update_block(&h, &cfg_ee.h, sizeof(struct cfg_header));
+}
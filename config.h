@@ -0,0 +1,56 @@
+#pragma once
+
+/* Settings that can be tuned per site without reflashing. They live in EEPROM and
+ * are read into cfg at boot, so the code using them just reads cfg.x. The CFG command
+ * and the TUI settings menu change them. */
+struct config {
+	uint16_t log_interval; /* s between log lines */
+	uint16_t log_flush; /* buffered bytes that make the logger write to the card */
+	uint16_t idle_timeout; /* s without activity until the display goes off */
+	uint16_t dim_timeout; /* and until it is dimmed */
+	uint16_t nonrtc_valid; /* minutes the clock is trusted for without the RTC */
+	uint8_t tui_refresh; /* display refresh interval, 5Hz ticks */
+	uint8_t sensor_max_age; /* s a reading is shown for */
+	char log_name[13]; /* 8.3, in the root directory */
+	/* New fields go here at the end, see config.c. */
+};
+
+extern struct config cfg;
+
+#define CFG_U8 0
+#define CFG_U16 1
+#define CFG_STR 2
+
+/* name, field, type, min, max (for strings, the size) */
+#define CFG_ITEMS \
+	CFG("LOGINT", log_interval, CFG_U16, 10, 3600) \
+	CFG("LOGFLUSH", log_flush, CFG_U16, 0, 288) \
+	CFG("IDLE", idle_timeout, CFG_U16, 10, 65535) \
+	CFG("DIM", dim_timeout, CFG_U16, 5, 65535) \
+	CFG("CLKVALID", nonrtc_valid, CFG_U16, 1, 10080) \
+	CFG("REFRESH", tui_refresh, CFG_U8, 1, 40) \
+	CFG("MAXAGE", sensor_max_age, CFG_U8, 2, 255) \
+	CFG("LOGNAME", log_name, CFG_STR, 1, 13)
+
+/* The item names, for building menus. */
+#define CFG(n, f, t, mi, ma) extern const unsigned char cfg_n_##f[];
+CFG_ITEMS
+#undef CFG
+
+void cfg_init(void);
+void cfg_defaults(void);
+void cfg_save(void);
+
+uint8_t cfg_count(void);
+PGM_P cfg_name(uint8_t i);
+uint8_t cfg_type(uint8_t i);
+uint16_t cfg_min(uint8_t i);
+uint16_t cfg_max(uint8_t i);
+/* Item index by name, or 255. */
+uint8_t cfg_find(const char *name);
+uint16_t cfg_get(uint8_t i);
+void cfg_set(uint8_t i, uint16_t v);
+/* From text, with the range (or 8.3 name) checked, returns 1 if it is not valid. */
+uint8_t cfg_parse(uint8_t i, const char *s);
+/* The value as text, buf needs to fit 13 characters. */
+void cfg_str(uint8_t i, unsigned char *buf);
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Bulk download of DATALOG.TXT over the UART, host/dload.py is the other end.
+ *
+ * DLOAD [offset [length [baud]]]
+ * answers "DL <offset> <end> <baud>" at the console rate, then switches to baud and
+ * waits (2s) for a 'G' from the host before streaming frames:
+ *	type, offset (4 bytes LE), len, len bytes of data, CRC16 (2 bytes LE)
+ * with the CRC (_crc_ccitt_update, from 0xFFFF) over everything before it.
+ * Types are 'D' (data), 'E' (end, offset == end) and 'X' (read error at offset,
+ * also when the card went away or was mounted again).
+ * Any byte from the host stops the stream. After the last frame we go back to the
+ * console rate. There is no per-frame ack: the host checks the CRCs and asks again
+ * from the first bad offset. The frames go out one per task step, so logging and
+ * the display keep going in between. */
+
+#include "main.h"
+#include "uart.h"
+#include "console.h"
+#include "lib.h"
+#include "ciface.h"
+#include "timer.h"
+#include "logger.h"
+#include "fat.h"
+#include <util/crc16.h>
+
+#define DL_CHUNK 64
+#define DL_GO 'G'
+
+/* Frame header and CRC around the data */
+#define DL_HDR 6
+#define DL_FRAME(n) (DL_HDR + (n) + 2)
+
+/* The data is already at fr + DL_HDR. The CRC of the next frame gets done
+ * while the ISR is still sending the previous one. */
+static void dl_frame(uint8_t *fr, uint8_t type, uint32_t off, uint8_t len)
+{
+	fr[0] = type;
+	for (uint8_t i=1; i < 5; i++) {
+		fr[i] = off;
+		off >>= 8;
+	}
+	fr[5] = len;
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i=0; i < DL_HDR + len; i++) crc = _crc_ccitt_update(crc, fr[i]);
+	fr[DL_HDR + len] = crc;
+	fr[DL_HDR + len + 1] = crc >> 8;
+	uart_write(fr, DL_FRAME(len));
+}
+
+static void dl_sendnum(uint32_t v)
+{
+	unsigned char buf[12];
+	buf[0] = ' ';
+	luint2str(buf+1, v);
+	sendstr(buf);
+}
+
+/* Wait for the host to come over to the new rate. */
+static uint8_t dl_sync(void)
+{
+	while (uart_isdata()) RECEIVE();
+	return uart_recv_timeout(2000) != DL_GO;
+}
+
+static uint32_t dl_arg(uint8_t n, uint32_t def)
+{
+	if (token_count <= n) return def;
+	return strtoul((char*)tokenptrs[n], NULL, 10);
+}
+
+struct dl_task {
+	struct fat_file_struct fd;
+	uint32_t off;
+	uint32_t end;
+	uint8_t gen; /* logger_sd_gen of the mount fd is on */
+	uint8_t fr[DL_FRAME(DL_CHUNK)];
+};
+
+/* One frame per step, until the end, a read error or the host saying something. */
+static uint8_t dl_step(void *ctx)
+{
+	struct dl_task *t = ctx;
+	if (uart_isdata())
+		return TASK_DONE;
+	if (t->off >= t->end) {
+		dl_frame(t->fr, 'E', t->off, 0);
+		return TASK_DONE;
+	}
+	uint8_t n = (t->end - t->off) > DL_CHUNK ? DL_CHUNK : t->end - t->off;
+	if ((logger_sd_status() != 1)||(logger_sd_gen() != t->gen)||
+		(fat_read_file(&t->fd, t->fr + DL_HDR, n) != n)) {
+		dl_frame(t->fr, 'X', t->off, 0);
+		return TASK_DONE;
+	}
+	dl_frame(t->fr, 'D', t->off, n);
+	t->off += n;
+	return TASK_MORE;
+}
+
+CIFACE_APP(dload_cmd, "DLOAD")
+{
+	struct dl_task t;
+	uint32_t con_baud = uart_get_baud();
+	uint32_t len = dl_arg(2, 0);
+	uint32_t baud = dl_arg(3, con_baud);
+	t.off = dl_arg(1, 0);
+	if (!uart_baud_ok(baud)) {
+		sendstr_P(PSTR("ERR BAUD"));
+		return;
+	}
+	if (logger_open_log(&t.fd)) {
+		sendstr_P(PSTR("ERR NO LOG"));
+		return;
+	}
+	t.gen = logger_sd_gen();
+	t.end = t.fd.dir_entry.file_size;
+	int32_t seek = t.off;
+	if ((t.off > t.end)||(!fat_seek_file(&t.fd, &seek, FAT_SEEK_SET))) {
+		sendstr_P(PSTR("ERR OFFSET"));
+		goto out;
+	}
+	if ((len)&&(len < t.end - t.off)) t.end = t.off + len;
+	sendstr_P(PSTR("DL"));
+	dl_sendnum(t.off);
+	dl_sendnum(t.end);
+	dl_sendnum(baud);
+	sendstr_P(PSTR("\r\n"));
+	uart_set_baud(baud);
+	if (dl_sync()) {
+		uart_set_baud(con_baud);
+		sendstr_P(PSTR("ERR SYNC"));
+		goto out;
+	}
+	task_exec(dl_step, &t);
+	uart_set_baud(con_baud);
+	while (uart_isdata()) RECEIVE();
+out:
+	fat_close_file(&t.fd);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include "main.h"
+#include "sensor.h"
+#include "ds18b20.h"
+#include <util/crc16.h>
+
+/* Minimal bit-banged 1-Wire for a single DS18B20 per pin (Skip ROM). The line needs an
+ * external pull-up, we only ever drive it low. */
+
+#define OW_SKIP_ROM 0xCC
+#define DS_CONVERT_T 0x44
+#define DS_READ_SCRATCHPAD 0xBE
+
+static void ow_low(uint8_t pin)
+{
+	*SENSOR_DDRREG(pin) |= SENSOR_PINMASK(pin);
+}
+
+static void ow_release(uint8_t pin)
+{
+	*SENSOR_DDRREG(pin) &= ~SENSOR_PINMASK(pin);
+}
+
+static uint8_t ow_sample(uint8_t pin)
+{
+	return *SENSOR_PINREG(pin) & SENSOR_PINMASK(pin);
+}
+
+/* Returns 1 if a device answered with a presence pulse. */
+static uint8_t ow_reset(uint8_t pin)
+{
+	ow_low(pin);
+	_delay_us(480);
+	cli();
+	ow_release(pin);
+	_delay_us(70);
+	uint8_t present = !ow_sample(pin);
+	sei();
+	_delay_us(410);
+	return present;
+}
+
+static void ow_write_bit(uint8_t pin, uint8_t b)
+{
+	cli();
+	ow_low(pin);
+	if (b) {
+		_delay_us(6);
+		ow_release(pin);
+		sei();
+		_delay_us(64);
+	} else {
+		_delay_us(60);
+		ow_release(pin);
+		sei();
+		_delay_us(10);
+	}
+}
+
+static uint8_t ow_read_bit(uint8_t pin)
+{
+	cli();
+	ow_low(pin);
+	_delay_us(6);
+	ow_release(pin);
+	_delay_us(9);
+	uint8_t b = !!ow_sample(pin);
+	sei();
+	_delay_us(55);
+	return b;
+}
+
+static void ow_write(uint8_t pin, uint8_t d)
+{
+	for (uint8_t i=0; i < 8; i++) {
+		ow_write_bit(pin, d & 1);
+		d >>= 1;
+	}
+}
+
+static uint8_t ow_read(uint8_t pin)
+{
+	uint8_t d = 0;
+	for (uint8_t i=0; i < 8; i++) {
+		d >>= 1;
+		if (ow_read_bit(pin)) d |= 0x80;
+	}
+	return d;
+}
+
+static void ds_init(uint8_t pin)
+{
+	*SENSOR_PORTREG(pin) &= ~SENSOR_PINMASK(pin);
+	ow_release(pin);
+}
+
+static uint16_t ds_start(uint8_t pin)
+{
+	if (!ow_reset(pin)) return 0; /* read will find out too */
+	ow_write(pin, OW_SKIP_ROM);
+	ow_write(pin, DS_CONVERT_T);
+	return 750; /* 12-bit conversion time */
+}
+
+static uint16_t ds_poll(uint8_t pin)
+{
+	/* Read slots return 0 while converting. */
+	if (!ow_read_bit(pin)) return 10;
+	return 0;
+}
+
+static uint8_t ds_read(uint8_t pin, int16_t *v)
+{
+	uint8_t sp[9];
+	uint8_t crc = 0;
+	if (!ow_reset(pin)) return SENSOR_E_NORESP;
+	ow_write(pin, OW_SKIP_ROM);
+	ow_write(pin, DS_READ_SCRATCHPAD);
+	for (uint8_t i=0; i < 9; i++) {
+		sp[i] = ow_read(pin);
+		crc = _crc_ibutton_update(crc, sp[i]);
+	}
+	if (crc) return SENSOR_E_CSUM;
+	int16_t t16 = (sp[1] << 8) | sp[0]; /* 1/16 C */
+	v[0] = (t16 * 5) / 8;
+	return SENSOR_OK;
+}
+
+static const char ds_u0[] PROGMEM = "T[C]";
+
+const struct sensor_ops ds18b20_ops PROGMEM = {
+	.init = ds_init,
+	.start = ds_start,
+	.poll = ds_poll,
+	.read = ds_read,
+	.units = { ds_u0, NULL },
+	.nvals = 1,
+	.scale = 1,
+	.interval = 2,
+	.vmin = { -550, 0 },
+	.vmax = { 1250, 0 },
+	.vdelta = { 50, 0 },
+};
@@ -0,0 +1,4 @@
+#pragma once
+#include "sensor.h"
+
+extern const struct sensor_ops ds18b20_ops;
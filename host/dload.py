@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+
+# Downloads DATALOG.TXT with the DLOAD command (see dload.c), needs pyserial.
+#
+#	host/dload.py [-b baud] [-c console_baud] /dev/ttyUSB0 datalog.txt
+#
+# An existing output file is resumed from its end, and a transfer that goes
+# bad (CRC, timeout) is restarted from the last good offset.
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+RETRIES = 5
+
+
+def crc_ccitt_update(crc, data):
+    # avr-libc _crc_ccitt_update
+    for d in data:
+        d ^= crc & 0xFF
+        d = (d ^ (d << 4)) & 0xFF
+        crc = (((d << 8) | (crc >> 8)) ^ (d >> 4) ^ (d << 3)) & 0xFFFF
+    return crc
+
+
+def read_exact(ser, n):
+    b = ser.read(n)
+    if len(b) != n:
+        raise IOError("timeout")
+    return b
+
+
+def command(ser, cmd):
+    """Sends a console command and returns its first line of output."""
+    ser.reset_input_buffer()
+    ser.write(cmd.encode() + b"\r")
+    echo = cmd.encode()
+    while True:
+        line = ser.readline()
+        if not line:
+            raise IOError("no answer to " + cmd)
+        line = line.strip()
+        if line and not line.endswith(echo):
+            return line.decode(errors="replace")
+
+
+def download(ser, out, off, baud, console_baud):
+    line = command(ser, "DLOAD %d 0 %d" % (off, baud))
+    f = line.split()
+    if len(f) != 4 or f[0] != "DL":
+        raise IOError(line)
+    off, end = int(f[1]), int(f[2])
+    print("%d..%d" % (off, end), file=sys.stderr)
+    ser.baudrate = baud
+    time.sleep(0.05)
+    ser.write(b"G")
+    try:
+        while True:
+            hdr = read_exact(ser, 6)
+            typ, foff, n = struct.unpack("<cIB", hdr)
+            data = read_exact(ser, n)
+            (crc,) = struct.unpack("<H", read_exact(ser, 2))
+            if crc_ccitt_update(0xFFFF, hdr + data) != crc:
+                raise IOError("CRC error at %d" % off)
+            if foff != off:
+                raise IOError("expected offset %d, got %d" % (off, foff))
+            if typ == b"E":
+                return off, True
+            if typ == b"X":
+                raise IOError("read error at %d" % off)
+            out.write(data)
+            off += n
+    except IOError:
+        # Stop the stream and let it get back to the console rate.
+        ser.write(b"x")
+        time.sleep(0.2)
+        raise
+    finally:
+        out.flush()
+        ser.baudrate = console_baud
+        time.sleep(0.05)
+        ser.reset_input_buffer()
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Download the data log")
+    ap.add_argument("-b", "--baud", type=int, default=500000)
+    ap.add_argument("-c", "--console-baud", type=int, default=9600)
+    ap.add_argument("port")
+    ap.add_argument("outfile")
+    a = ap.parse_args()
+    ser = serial.Serial(a.port, a.console_baud, timeout=2)
+    with open(a.outfile, "ab") as out:
+        off = out.tell()
+        for tries in range(RETRIES):
+            try:
+                off, done = download(ser, out, off, a.baud, a.console_baud)
+                if done:
+                    print("done, %d bytes" % off, file=sys.stderr)
+                    return 0
+            except IOError as e:
+                print(e, file=sys.stderr)
+                off = out.tell()
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
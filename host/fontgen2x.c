@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Host tool: expands mfont8x8.c into the double height font (mfont2x.c) that lcd.c
+ * draws with, already in the SSD1306 bit order. The Makefile runs this. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../mfont8x8.c"
+
+#define GLYPHS (sizeof(mfont)/sizeof(mfont[0]))
+
+static uint8_t flip_bits(uint8_t bits) {
+	bits = (bits >> 4) | (bits << 4);
+	bits = ((bits >> 2) & 0x33) | ((bits << 2) & 0xCC);
+	bits = ((bits >> 1) & 0x55) | ((bits << 1) & 0xAA);
+	return bits;
+}
+
+/* Each font bit becomes two, the top nibble goes to the upper page. */
+static uint8_t expand(uint8_t nib) {
+	uint8_t o = 0;
+	for (int b=0; b<4; b++) {
+		o = o >> 2;
+		if (nib & (1 << b)) o |= 0xC0;
+	}
+	return flip_bits(o);
+}
+
+int main(void) {
+	printf("/* Generated by host/fontgen2x.c from mfont8x8.c, do not edit. */\n");
+	printf("#include <stdint.h>\n#include <avr/pgmspace.h>\n\n");
+	printf("const uint8_t PROGMEM mfont2x[%u][2][8] = {\n", (unsigned)GLYPHS);
+	for (unsigned c=0; c < GLYPHS; c++) {
+		printf("\t{ /* 0x%02X */\n", c + 0x20);
+		for (int p=0; p < 2; p++) {
+			printf("\t\t{");
+			for (int x=0; x < 8; x++) {
+				uint8_t d = mfont[c][x];
+				uint8_t o = p ? expand(d & 0xF) : expand(d >> 4);
+				printf(" 0x%02X%s", o, x < 7 ? "," : " ");
+			}
+			printf("},\n");
+		}
+		printf("\t},\n");
+	}
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#define cli() do { } while(0)
+#define sei() do { } while(0)
+#define ISR(v) void v(void); void v(void)
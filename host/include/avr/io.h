@@ -0,0 +1,12 @@
+/* The firmware headers want the register names, the host build never touches them. */
+#pragma once
+#include <stdint.h>
+
+/* The firmware is for the ATmega328P, the headers pick their pin mappings with this. */
+#ifndef __AVR_ATmega328P__
+#define __AVR_ATmega328P__
+#endif
+
+#ifndef _BV
+#define _BV(b) (1 << (b))
+#endif
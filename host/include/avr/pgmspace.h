@@ -0,0 +1,24 @@
+/* Just enough of avr/pgmspace.h to compile the firmware on the host,
+ * flash is ordinary memory here. */
+#pragma once
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(a) (*(const uint8_t *)(a))
+/* Word reads are used on pointer tables too, so keep the element type. */
+#define pgm_read_word(a) (*(a))
+#define pgm_read_dword(a) (*(a))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define strcasecmp_P strcasecmp
+#define strncmp_P strncmp
+#define sprintf_P sprintf
@@ -0,0 +1,6 @@
+#pragma once
+
+#define sleep_mode() do { } while(0)
+#define set_sleep_mode(m) do { } while(0)
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
@@ -0,0 +1,751 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Host tool: reads DATALOG.TXT files (as written by logger.c, any number of them
+ * concatenated or given in order) and writes them out cleaned up ("make logtool"):
+ *
+ *	host/logtool [-j threads] [-i seconds] [-o out.csv] [-b out.bin] DATALOG.TXT...
+ *
+ * The files are mmapped and split into chunks at line boundaries that are parsed in
+ * parallel; finding the lines is memchr, which libc does with SIMD.
+ *
+ * Rows logged while the clock was not valid ('?') get their time from the nearest
+ * valid row of the same boot (the uptime column only grows within a boot), and are
+ * marked 'r'. Rows with nothing to go by are dropped. Empty value fields are NaN.
+ * The columns come from the "#date time,valid,uptime,..." headers, each one covering
+ * the lines up to the next; a header with other columns than the one before it (the
+ * sensors changed) adds the new ones, and the lines under it leave the missing ones
+ * empty. Lines before any header get numbered columns.
+ *
+ * Without -i every row is written as is; with -i the rows are sorted by time and
+ * binned into that many seconds, giving n and the mean, min and max of each value
+ * (the quality columns are left out).
+ * The CSV goes to stdout unless -o is given. -b writes the same table in columns:
+ *	"DLCOL1\n", uint32_t ncols, uint64_t nrows, ncols NUL terminated names,
+ *	int64_t time[nrows] (unix time, UTC as logged), then float col[nrows] per column
+ * all little-endian; quality columns hold the ASCII code of the letter. */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAXCOLS 64
+#define CHUNK_MIN (1 << 20)
+#define NOTIME INT64_MIN
+
+struct rows {
+	size_t n, cap;
+	int64_t *t;
+	uint32_t *up;
+	char *valid; /* '*', '?' and after repairing also 'r' */
+	float *v; /* n * ncols */
+};
+
+/* The fields after uptime under one header, as columns (NOCOL for none). */
+struct segment {
+	unsigned nf;
+	uint8_t col[MAXCOLS];
+};
+#define NOCOL 0xFF
+
+struct chunk {
+	const char *p, *e;
+	size_t seg;
+	struct rows r;
+	size_t bad;
+};
+
+static unsigned ncols;
+static char *colname[MAXCOLS];
+static uint8_t colq[MAXCOLS]; /* a quality letter column */
+
+static struct segment *segs;
+static size_t nsegs;
+
+static struct chunk *chunks;
+static size_t nchunks;
+static size_t next_chunk;
+
+static void *xrealloc(void *p, size_t sz)
+{
+	p = realloc(p, sz);
+	if (!p) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void rows_grow(struct rows *r, size_t need)
+{
+	if (need <= r->cap)
+		return;
+	size_t cap = r->cap ? r->cap : 4096;
+	while (cap < need)
+		cap *= 2;
+	r->t = xrealloc(r->t, cap * sizeof(*r->t));
+	r->up = xrealloc(r->up, cap * sizeof(*r->up));
+	r->valid = xrealloc(r->valid, cap);
+	r->v = xrealloc(r->v, cap * (ncols ? ncols : 1) * sizeof(*r->v));
+	r->cap = cap;
+}
+
+static int digits(const char *p, int n, int *v)
+{
+	*v = 0;
+	for (int i = 0; i < n; i++) {
+		unsigned d = (unsigned char)p[i] - '0';
+		if (d > 9)
+			return 1;
+		*v = *v * 10 + d;
+	}
+	return 0;
+}
+
+/* Days from 1970-01-01, for a proleptic Gregorian date. */
+static int64_t days_from_civil(int y, int m, int d)
+{
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+/* "YYYY-MM-DD hh:mm:ss" */
+static int64_t parse_time(const char *p)
+{
+	int y, mo, d, h, mi, s;
+	if (digits(p, 4, &y) || p[4] != '-' || digits(p + 5, 2, &mo) || p[7] != '-' ||
+		digits(p + 8, 2, &d) || p[10] != ' ' || digits(p + 11, 2, &h) || p[13] != ':' ||
+		digits(p + 14, 2, &mi) || p[16] != ':' || digits(p + 17, 2, &s))
+		return NOTIME;
+	if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 59)
+		return NOTIME;
+	return days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+}
+
+/* The values are short fixed point decimals, like "-12.5". */
+static float parse_value(const char *p, const char *e)
+{
+	int neg = 0;
+	int32_t v = 0, div = 1;
+	if (p < e && *p == '-') {
+		neg = 1;
+		p++;
+	}
+	if (p == e)
+		return NAN;
+	for (; p < e && *p != '.'; p++) {
+		unsigned d = (unsigned char)*p - '0';
+		if (d > 9)
+			return NAN;
+		v = v * 10 + d;
+	}
+	if (p < e)
+		p++;
+	for (; p < e; p++) {
+		unsigned d = (unsigned char)*p - '0';
+		if (d > 9)
+			return NAN;
+		v = v * 10 + d;
+		div *= 10;
+	}
+	return (neg ? -v : v) / (float)div;
+}
+
+/* One data line, without the newline. Returns 1 if it is not one. */
+static int parse_line(struct rows *r, const struct segment *sg, const char *p, const char *e)
+{
+	/* "YYYY-MM-DD hh:mm:ss,V,uuuuuuuuuu" */
+	if (e - p < 23 || p[19] != ',' || p[21] != ',')
+		return 1;
+	int64_t t = parse_time(p);
+	if (t == NOTIME)
+		return 1;
+	const char *f = p + 22;
+	uint32_t up = 0;
+	for (; f < e && *f != ','; f++) {
+		unsigned d = (unsigned char)*f - '0';
+		if (d > 9)
+			return 1;
+		up = up * 10 + d;
+	}
+	rows_grow(r, r->n + 1);
+	size_t i = r->n++;
+	r->valid[i] = p[20] == '*' ? '*' : '?';
+	r->t[i] = r->valid[i] == '*' ? t : NOTIME;
+	r->up[i] = up;
+	float *v = r->v + i * ncols;
+	for (unsigned c = 0; c < ncols; c++)
+		v[c] = NAN;
+	for (unsigned k = 0; k < sg->nf && f < e; k++) {
+		const char *s = ++f;
+		const char *fe = memchr(s, ',', e - s);
+		if (!fe)
+			fe = e;
+		unsigned c = sg->col[k];
+		f = fe;
+		if (c == NOCOL)
+			continue;
+		if (colq[c])
+			v[c] = fe > s ? (float)(unsigned char)*s : NAN;
+		else
+			v[c] = parse_value(s, fe);
+	}
+	return 0;
+}
+
+static void *parse_thread(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		size_t ci = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_RELAXED);
+		if (ci >= nchunks)
+			return NULL;
+		struct chunk *c = &chunks[ci];
+		const struct segment *sg = &segs[c->seg];
+		const char *p = c->p;
+		while (p < c->e) {
+			const char *nl = memchr(p, '\n', c->e - p);
+			const char *le = nl ? nl : c->e;
+			if (le > p && le[-1] == '\r')
+				le--;
+			if (p < le && *p != '#' && parse_line(&c->r, sg, p, le))
+				c->bad++;
+			p = nl ? nl + 1 : c->e;
+		}
+	}
+}
+
+/* The column called p..e, added if it is a new one. */
+static uint8_t find_col(const char *p, const char *e)
+{
+	size_t l = e - p;
+	for (unsigned c = 0; c < ncols; c++)
+		if (strlen(colname[c]) == l && !memcmp(colname[c], p, l))
+			return c;
+	if (ncols >= MAXCOLS)
+		return NOCOL;
+	colname[ncols] = strndup(p, l);
+	colq[ncols] = l >= 2 && p[l - 2] == ':' && p[l - 1] == 'Q';
+	return ncols++;
+}
+
+/* The fields after uptime of a header line, or numbered ones for a data line. */
+static void read_header(struct segment *sg, const char *p, const char *le)
+{
+	int header = *p == '#';
+	int f = 0;
+	sg->nf = 0;
+	while (p <= le && sg->nf < MAXCOLS) {
+		const char *fe = memchr(p, ',', le - p);
+		if (!fe)
+			fe = le;
+		if (f++ >= 3) {
+			if (header) {
+				sg->col[sg->nf] = find_col(p, fe);
+			} else {
+				char b[16];
+				int l = snprintf(b, sizeof(b), "c%u", sg->nf);
+				sg->col[sg->nf] = find_col(b, b + l);
+			}
+			sg->nf++;
+		}
+		p = fe + 1;
+	}
+}
+
+/* Starts a segment for the header (or the headerless data line) at p, unless it
+ * has the same columns as the one before. */
+static void add_segment(const char *fn, const char *base, const char *p, const char *le)
+{
+	struct segment sg;
+	read_header(&sg, p, le);
+	if (nsegs) {
+		const struct segment *prev = &segs[nsegs - 1];
+		if (prev->nf == sg.nf && !memcmp(prev->col, sg.col, sg.nf))
+			return;
+		fprintf(stderr, "%s: the columns change at offset %zu\n", fn, (size_t)(p - base));
+	}
+	segs = xrealloc(segs, (nsegs + 1) * sizeof(*segs));
+	segs[nsegs++] = sg;
+}
+
+static const char *map_file(const char *fn, size_t *len)
+{
+	int fd = open(fn, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(fn);
+		exit(1);
+	}
+	*len = st.st_size;
+	if (!*len) {
+		close(fd);
+		return NULL;
+	}
+	const char *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(fn);
+		exit(1);
+	}
+	madvise((void *)p, *len, MADV_SEQUENTIAL | MADV_WILLNEED);
+	return p;
+}
+
+/* Splits p..e into chunks of about sz that end at a newline, all under the last segment. */
+static void add_chunks(const char *p, const char *e, size_t sz)
+{
+	while (p < e) {
+		const char *ce = p + sz < e ? p + sz : e;
+		if (ce < e) {
+			const char *nl = memchr(ce, '\n', e - ce);
+			ce = nl ? nl + 1 : e;
+		}
+		chunks = xrealloc(chunks, (nchunks + 1) * sizeof(*chunks));
+		memset(&chunks[nchunks], 0, sizeof(*chunks));
+		chunks[nchunks].p = p;
+		chunks[nchunks].e = ce;
+		chunks[nchunks].seg = nsegs - 1;
+		nchunks++;
+		p = ce;
+	}
+}
+
+/* The header lines split a file into segments, the chunks stay within one. Finding
+ * them is a memchr for the '#', which the data lines do not have. Lines before the
+ * first header of the first file get their columns counted from the first data line. */
+static void add_file(const char *fn, const char *p, size_t len, size_t sz)
+{
+	const char *e = p + len;
+	const char *s = p;
+	const char *q = p;
+	while (s < e) {
+		const char *h = memchr(q, '#', e - q);
+		if (h && h > p && h[-1] != '\n') {
+			q = h + 1;
+			continue;
+		}
+		if (!h)
+			h = e;
+		if (!nsegs) {
+			/* The first data line, if there is one before the header. */
+			const char *l = s;
+			while (l < h && (*l == '\n' || *l == '\r'))
+				l++;
+			if (l < h) {
+				const char *nl = memchr(l, '\n', h - l);
+				const char *le = nl ? nl : h;
+				if (le > l && le[-1] == '\r')
+					le--;
+				add_segment(fn, p, l, le);
+			}
+		}
+		if (h > s && nsegs)
+			add_chunks(s, h, sz);
+		if (h == e)
+			break;
+		const char *nl = memchr(h, '\n', e - h);
+		const char *le = nl ? nl : e;
+		if (le > h && le[-1] == '\r')
+			le--;
+		add_segment(fn, p, h, le);
+		s = h;
+		q = h + 1;
+	}
+}
+
+/* All the chunks in order as one table. */
+static void merge(struct rows *all)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < nchunks; i++)
+		n += chunks[i].r.n;
+	memset(all, 0, sizeof(*all));
+	rows_grow(all, n ? n : 1);
+	for (size_t i = 0; i < nchunks; i++) {
+		struct rows *r = &chunks[i].r;
+		memcpy(all->t + all->n, r->t, r->n * sizeof(*r->t));
+		memcpy(all->up + all->n, r->up, r->n * sizeof(*r->up));
+		memcpy(all->valid + all->n, r->valid, r->n);
+		memcpy(all->v + all->n * ncols, r->v, r->n * ncols * sizeof(*r->v));
+		all->n += r->n;
+		free(r->t);
+		free(r->up);
+		free(r->valid);
+		free(r->v);
+	}
+}
+
+/* Gives the '?' rows the time of the nearest valid row in the same boot plus the
+ * uptime difference. A boot ends where the uptime goes backwards. */
+static size_t repair(struct rows *r)
+{
+	size_t dropped = 0;
+	int64_t *next_off = xrealloc(NULL, r->n * sizeof(*next_off));
+	uint32_t *next_up = xrealloc(NULL, r->n * sizeof(*next_up));
+	int64_t off = NOTIME;
+	uint32_t vup = 0;
+	for (size_t i = r->n; i-- > 0;) {
+		if (i + 1 < r->n && r->up[i] > r->up[i + 1])
+			off = NOTIME;
+		if (r->valid[i] == '*') {
+			off = r->t[i] - r->up[i];
+			vup = r->up[i];
+		}
+		next_off[i] = off;
+		next_up[i] = vup;
+	}
+	off = NOTIME;
+	size_t o = 0;
+	for (size_t i = 0; i < r->n; i++) {
+		if (i && r->up[i] < r->up[i - 1])
+			off = NOTIME;
+		if (r->valid[i] == '*') {
+			off = r->t[i] - r->up[i];
+			vup = r->up[i];
+		} else {
+			int64_t use = off;
+			if (next_off[i] != NOTIME &&
+				(off == NOTIME || next_up[i] - r->up[i] < r->up[i] - vup))
+				use = next_off[i];
+			if (use == NOTIME) {
+				dropped++;
+				continue;
+			}
+			r->t[i] = use + r->up[i];
+			r->valid[i] = 'r';
+		}
+		r->t[o] = r->t[i];
+		r->up[o] = r->up[i];
+		r->valid[o] = r->valid[i];
+		memmove(r->v + o * ncols, r->v + i * ncols, ncols * sizeof(*r->v));
+		o++;
+	}
+	r->n = o;
+	free(next_off);
+	free(next_up);
+	return dropped;
+}
+
+static void put_time(FILE *f, int64_t t)
+{
+	time_t tt = t;
+	struct tm tm;
+	char b[32];
+	gmtime_r(&tt, &tm);
+	strftime(b, sizeof(b), "%Y-%m-%d %H:%M:%S", &tm);
+	fputs(b, f);
+}
+
+static void put_value(FILE *f, float v)
+{
+	if (!isnan(v))
+		fprintf(f, "%.7g", v);
+}
+
+struct table {
+	size_t n;
+	unsigned cols;
+	char **name;
+	int64_t *t;
+	float *v; /* n * cols */
+};
+
+static void write_bin(const char *fn, const struct table *tb)
+{
+	FILE *f = fopen(fn, "wb");
+	if (!f) {
+		perror(fn);
+		exit(1);
+	}
+	uint32_t nc = tb->cols;
+	uint64_t nr = tb->n;
+	fputs("DLCOL1\n", f);
+	fwrite(&nc, sizeof(nc), 1, f);
+	fwrite(&nr, sizeof(nr), 1, f);
+	for (unsigned c = 0; c < tb->cols; c++)
+		fwrite(tb->name[c], strlen(tb->name[c]) + 1, 1, f);
+	fwrite(tb->t, sizeof(*tb->t), tb->n, f);
+	float *col = xrealloc(NULL, (tb->n ? tb->n : 1) * sizeof(*col));
+	for (unsigned c = 0; c < tb->cols; c++) {
+		for (size_t i = 0; i < tb->n; i++)
+			col[i] = tb->v[i * tb->cols + c];
+		fwrite(col, sizeof(*col), tb->n, f);
+	}
+	free(col);
+	if (fclose(f)) {
+		perror(fn);
+		exit(1);
+	}
+}
+
+static void write_rows(FILE *f, const struct rows *r)
+{
+	fputs("time,valid,uptime", f);
+	for (unsigned c = 0; c < ncols; c++)
+		fprintf(f, ",%s", colname[c]);
+	fputc('\n', f);
+	for (size_t i = 0; i < r->n; i++) {
+		put_time(f, r->t[i]);
+		fprintf(f, ",%c,%u", r->valid[i], r->up[i]);
+		const float *v = r->v + i * ncols;
+		for (unsigned c = 0; c < ncols; c++) {
+			fputc(',', f);
+			if (colq[c] && !isnan(v[c]))
+				fputc((int)v[c], f);
+			else
+				put_value(f, v[c]);
+		}
+		fputc('\n', f);
+	}
+}
+
+static const struct rows *sort_rows;
+
+static int cmp_time(const void *a, const void *b)
+{
+	int64_t ta = sort_rows->t[*(const size_t *)a];
+	int64_t tb = sort_rows->t[*(const size_t *)b];
+	return (ta > tb) - (ta < tb);
+}
+
+/* Bins of iv seconds: n, then mean, min and max per value column. */
+static void resample(const struct rows *r, int64_t iv, struct table *tb)
+{
+	size_t *ord = xrealloc(NULL, (r->n ? r->n : 1) * sizeof(*ord));
+	int sorted = 1;
+	for (size_t i = 0; i < r->n; i++) {
+		ord[i] = i;
+		if (i && r->t[i] < r->t[i - 1])
+			sorted = 0;
+	}
+	if (!sorted) {
+		sort_rows = r;
+		qsort(ord, r->n, sizeof(*ord), cmp_time);
+	}
+	unsigned vc[MAXCOLS], nv = 0;
+	for (unsigned c = 0; c < ncols; c++)
+		if (!colq[c])
+			vc[nv++] = c;
+	memset(tb, 0, sizeof(*tb));
+	tb->cols = 1 + 3 * nv;
+	tb->name = xrealloc(NULL, tb->cols * sizeof(*tb->name));
+	tb->name[0] = "n";
+	for (unsigned k = 0; k < nv; k++) {
+		static const char *const agg[3] = { "mean", "min", "max" };
+		for (int a = 0; a < 3; a++) {
+			char b[128];
+			snprintf(b, sizeof(b), "%s %s", colname[vc[k]], agg[a]);
+			tb->name[1 + 3 * k + a] = strdup(b);
+		}
+	}
+	size_t cap = 0;
+	double sum[MAXCOLS];
+	uint32_t cnt[MAXCOLS];
+	for (size_t i = 0; i < r->n;) {
+		int64_t t = r->t[ord[i]];
+		int64_t bin = (t >= 0 ? t : t - iv + 1) / iv * iv;
+		if (tb->n == cap) {
+			cap = cap ? cap * 2 : 1024;
+			tb->t = xrealloc(tb->t, cap * sizeof(*tb->t));
+			tb->v = xrealloc(tb->v, cap * tb->cols * sizeof(*tb->v));
+		}
+		float *o = tb->v + tb->n * tb->cols;
+		for (unsigned k = 0; k < nv; k++) {
+			sum[k] = 0;
+			cnt[k] = 0;
+			o[1 + 3 * k + 1] = INFINITY;
+			o[1 + 3 * k + 2] = -INFINITY;
+		}
+		uint32_t n = 0;
+		for (; i < r->n && r->t[ord[i]] < bin + iv; i++, n++) {
+			const float *v = r->v + ord[i] * ncols;
+			for (unsigned k = 0; k < nv; k++) {
+				float x = v[vc[k]];
+				if (isnan(x))
+					continue;
+				sum[k] += x;
+				cnt[k]++;
+				if (x < o[1 + 3 * k + 1])
+					o[1 + 3 * k + 1] = x;
+				if (x > o[1 + 3 * k + 2])
+					o[1 + 3 * k + 2] = x;
+			}
+		}
+		o[0] = n;
+		for (unsigned k = 0; k < nv; k++) {
+			if (cnt[k]) {
+				o[1 + 3 * k] = sum[k] / cnt[k];
+			} else {
+				o[1 + 3 * k] = NAN;
+				o[1 + 3 * k + 1] = NAN;
+				o[1 + 3 * k + 2] = NAN;
+			}
+		}
+		tb->t[tb->n++] = bin;
+	}
+	free(ord);
+}
+
+static void write_table(FILE *f, const struct table *tb)
+{
+	fputs("time", f);
+	for (unsigned c = 0; c < tb->cols; c++)
+		fprintf(f, ",%s", tb->name[c]);
+	fputc('\n', f);
+	for (size_t i = 0; i < tb->n; i++) {
+		put_time(f, tb->t[i]);
+		for (unsigned c = 0; c < tb->cols; c++) {
+			fputc(',', f);
+			put_value(f, tb->v[i * tb->cols + c]);
+		}
+		fputc('\n', f);
+	}
+}
+
+/* The rows as a table for -b, with the time validity as its ASCII code too. */
+static void rows_table(const struct rows *r, struct table *tb)
+{
+	tb->n = r->n;
+	tb->cols = ncols + 2;
+	tb->name = xrealloc(NULL, tb->cols * sizeof(*tb->name));
+	tb->name[0] = "valid";
+	tb->name[1] = "uptime";
+	memcpy(tb->name + 2, colname, ncols * sizeof(*colname));
+	tb->t = r->t;
+	tb->v = xrealloc(NULL, (r->n ? r->n : 1) * tb->cols * sizeof(*tb->v));
+	for (size_t i = 0; i < r->n; i++) {
+		float *o = tb->v + i * tb->cols;
+		o[0] = (unsigned char)r->valid[i];
+		o[1] = r->up[i];
+		memcpy(o + 2, r->v + i * ncols, ncols * sizeof(*o));
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: logtool [-j threads] [-i seconds] [-o out.csv] [-b out.bin] DATALOG.TXT...\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long iv = 0;
+	const char *csv_fn = NULL, *bin_fn = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:i:o:b:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atol(optarg);
+			break;
+		case 'i':
+			iv = atol(optarg);
+			if (iv < 1)
+				usage();
+			break;
+		case 'o':
+			csv_fn = optarg;
+			break;
+		case 'b':
+			bin_fn = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc)
+		usage();
+	if (threads < 1)
+		threads = 1;
+
+	size_t total = 0;
+	int nf = argc - optind;
+	const char **map = xrealloc(NULL, nf * sizeof(*map));
+	size_t *len = xrealloc(NULL, nf * sizeof(*len));
+	for (int i = 0; i < nf; i++) {
+		map[i] = map_file(argv[optind + i], &len[i]);
+		total += len[i];
+	}
+	size_t sz = total / (threads * 8);
+	if (sz < CHUNK_MIN)
+		sz = CHUNK_MIN;
+	for (int i = 0; i < nf; i++)
+		if (map[i])
+			add_file(argv[optind + i], map[i], len[i], sz);
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_t *th = xrealloc(NULL, threads * sizeof(*th));
+	for (long i = 0; i < threads; i++)
+		if (pthread_create(&th[i], NULL, parse_thread, NULL)) {
+			fprintf(stderr, "cannot start threads\n");
+			return 1;
+		}
+	for (long i = 0; i < threads; i++)
+		pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	size_t bad = 0;
+	for (size_t i = 0; i < nchunks; i++)
+		bad += chunks[i].bad;
+	struct rows all;
+	merge(&all);
+	size_t parsed = all.n;
+	size_t dropped = repair(&all);
+	double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	fprintf(stderr, "%zu rows (%zu bad lines, %zu without a time dropped), parsed %.1f MB in %.3f s (%.0f MB/s)\n",
+		parsed, bad, dropped, total / 1e6, s, s > 0 ? total / 1e6 / s : 0);
+
+	FILE *f = stdout;
+	if (csv_fn) {
+		f = fopen(csv_fn, "w");
+		if (!f) {
+			perror(csv_fn);
+			return 1;
+		}
+	}
+	struct table tb;
+	if (iv) {
+		resample(&all, iv, &tb);
+		if (!bin_fn || csv_fn)
+			write_table(f, &tb);
+	} else {
+		if (!bin_fn || csv_fn)
+			write_rows(f, &all);
+		if (bin_fn)
+			rows_table(&all, &tb);
+	}
+	if (bin_fn)
+		write_bin(bin_fn, &tb);
+	if (fclose(f)) {
+		perror(csv_fn ? csv_fn : "stdout");
+		return 1;
+	}
+	return 0;
+}
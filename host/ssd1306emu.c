@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Host tool: an SSD1306 on a software I2C bus. This implements the swi2c_* calls
+ * that SSD1306.c makes, so everything from lcd.c down to the command bytes is the
+ * real firmware code; here we decode the bytes into a GDDRAM like the controller would.
+ * Only the commands the firmware uses are modelled, the rest are just skipped over. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "../SSD1306.h"
+#include "ssd1306emu.h"
+
+#define W SSD1306_LCDWIDTH
+#define PAGES (SSD1306_LCDHEIGHT/8)
+
+static uint8_t gram[PAGES][W];
+
+static uint8_t col_s = 0, col_e = W-1, page_s = 0, page_e = PAGES-1;
+static uint8_t col, page;
+static uint8_t addr_mode = 2; /* 0 = horizontal, 1 = vertical, 2 = page (the reset default) */
+static uint8_t disp_on;
+static uint8_t contrast = 0x7F;
+static uint8_t seg_remap, com_dec;
+
+/* Bus state */
+static uint8_t plugged = 1;
+static unsigned long nak_in; /* NAK the byte this many bytes from now, 0 = never */
+static uint8_t addressed;
+static uint8_t ctrl; /* expecting a control byte */
+static uint8_t data_mode;
+static uint8_t single; /* Co = 1: one byte, then another control byte */
+
+/* Command parser state */
+static uint8_t cmd[8];
+static uint8_t cmd_n, cmd_need;
+
+static struct emu_stats st;
+
+static uint8_t cmd_args(uint8_t c)
+{
+	switch (c) {
+	case SSD1306_MEMORYMODE:
+	case SSD1306_SETCONTRAST:
+	case SSD1306_CHARGEPUMP:
+	case SSD1306_SETMULTIPLEX:
+	case SSD1306_SETDISPLAYOFFSET:
+	case SSD1306_SETDISPLAYCLOCKDIV:
+	case SSD1306_SETPRECHARGE:
+	case SSD1306_SETCOMPINS:
+	case SSD1306_SETVCOMDETECT:
+		return 1;
+	case SSD1306_COLUMNADDR:
+	case SSD1306_PAGEADDR:
+	case SSD1306_SET_VERTICAL_SCROLL_AREA:
+		return 2;
+	case SSD1306_VERTICAL_AND_RIGHT_HORIZONTAL_SCROLL:
+	case SSD1306_VERTICAL_AND_LEFT_HORIZONTAL_SCROLL:
+		return 5;
+	case SSD1306_RIGHT_HORIZONTAL_SCROLL:
+	case SSD1306_LEFT_HORIZONTAL_SCROLL:
+	case SSD1306_RIGHT_CONTENT_SCROLL:
+	case SSD1306_LEFT_CONTENT_SCROLL:
+		return 6;
+	}
+	return 0;
+}
+
+/* One column content scroll. The direction is in SEG terms: right is towards the
+ * higher column addresses, unless the column remap has them run the other way. */
+static void content_scroll(uint8_t right, uint8_t y0, uint8_t y1, uint8_t x0, uint8_t x1)
+{
+	if ((y1 >= PAGES)||(x1 >= W)||(y0 > y1)||(x0 >= x1))
+		return;
+	uint8_t down = right == seg_remap; /* towards the lower column addresses */
+	for (uint8_t p = y0; p <= y1; p++) {
+		if (down)
+			memmove(&gram[p][x0], &gram[p][x0+1], x1 - x0);
+		else
+			memmove(&gram[p][x0+1], &gram[p][x0], x1 - x0);
+	}
+}
+
+static void cmd_exec(void)
+{
+	uint8_t c = cmd[0];
+	switch (c) {
+	case SSD1306_DISPLAYOFF:
+		disp_on = 0;
+		break;
+	case SSD1306_DISPLAYON:
+		disp_on = 1;
+		break;
+	case SSD1306_SETCONTRAST:
+		contrast = cmd[1];
+		break;
+	case SSD1306_MEMORYMODE:
+		addr_mode = cmd[1] & 3;
+		break;
+	case SSD1306_COLUMNADDR:
+		col_s = cmd[1] % W;
+		col_e = cmd[2] % W;
+		col = col_s;
+		break;
+	case SSD1306_PAGEADDR:
+		page_s = cmd[1] % PAGES;
+		page_e = cmd[2] % PAGES;
+		page = page_s;
+		break;
+	case SSD1306_SEGREMAP:
+	case SSD1306_SEGREMAP | 1:
+		seg_remap = c & 1;
+		break;
+	case SSD1306_COMSCANINC:
+		com_dec = 0;
+		break;
+	case SSD1306_COMSCANDEC:
+		com_dec = 1;
+		break;
+	case SSD1306_RIGHT_CONTENT_SCROLL:
+	case SSD1306_LEFT_CONTENT_SCROLL:
+		content_scroll(c == SSD1306_RIGHT_CONTENT_SCROLL, cmd[2], cmd[4], cmd[5], cmd[6]);
+		break;
+	default:
+		if ((addr_mode == 2)&&(c >= 0xB0)&&(c <= 0xB7)) {
+			page = (c & 7) % PAGES;
+		} else if ((addr_mode == 2)&&(c < 0x20)) {
+			if (c & 0x10)
+				col = ((col & 0x0F) | ((c & 0x0F) << 4)) % W;
+			else
+				col = (col & 0xF0) | (c & 0x0F);
+		}
+		break;
+	}
+}
+
+static void cmd_byte(uint8_t d)
+{
+	st.cmd_bytes++;
+	if (!cmd_n) cmd_need = cmd_args(d);
+	cmd[cmd_n++] = d;
+	if (cmd_n > cmd_need) {
+		cmd_exec();
+		cmd_n = 0;
+	}
+}
+
+static void data_byte(uint8_t d)
+{
+	st.data_bytes++;
+	gram[page][col] = d;
+	switch (addr_mode) {
+	case 0:
+		if (col++ < col_e) break;
+		col = col_s;
+		if (page++ >= page_e) page = page_s;
+		break;
+	case 1:
+		if (page++ < page_e) break;
+		page = page_s;
+		if (col++ >= col_e) col = col_s;
+		break;
+	default:
+		if (col < W-1) col++;
+		break;
+	}
+}
+
+void swi2c_init(void)
+{
+}
+
+static int nak_now(void)
+{
+	if (!nak_in)
+		return 0;
+	return --nak_in == 0;
+}
+
+unsigned char swi2c_start(unsigned char address)
+{
+	st.bus_bytes++;
+	addressed = plugged && (address == SSD1306_I2C_ADDRESS);
+	if (addressed && nak_now())
+		addressed = 0;
+	if (!addressed)
+		return 2;
+	st.xfers++;
+	ctrl = 1;
+	cmd_n = 0;
+	return 0;
+}
+
+unsigned char swi2c_write(unsigned char d)
+{
+	st.bus_bytes++;
+	if (!addressed)
+		return 1;
+	if (nak_now()) {
+		addressed = 0;
+		return 1;
+	}
+	if (ctrl) {
+		single = !!(d & 0x80);
+		data_mode = !!(d & 0x40);
+		ctrl = 0;
+		return 0;
+	}
+	if (data_mode)
+		data_byte(d);
+	else
+		cmd_byte(d);
+	if (single)
+		ctrl = 1;
+	return 0;
+}
+
+void swi2c_stop(void)
+{
+	addressed = 0;
+}
+
+void emu_plug(int in)
+{
+	if (in && !plugged) {
+		/* Power on reset, with whatever the GDDRAM happens to hold. */
+		for (int p = 0; p < PAGES; p++)
+			for (int c = 0; c < W; c++)
+				gram[p][c] = rand();
+		col_s = 0; col_e = W-1; page_s = 0; page_e = PAGES-1;
+		col = 0; page = 0;
+		addr_mode = 2;
+		disp_on = 0;
+		contrast = 0x7F;
+		seg_remap = 0;
+		com_dec = 0;
+		cmd_n = 0;
+	}
+	plugged = in;
+	addressed = 0;
+}
+
+void emu_nak_after(unsigned long n)
+{
+	nak_in = n;
+}
+
+void emu_get_stats(struct emu_stats *s)
+{
+	*s = st;
+}
+
+void emu_reset_stats(void)
+{
+	memset(&st, 0, sizeof(st));
+}
+
+int emu_display_on(void)
+{
+	return disp_on;
+}
+
+int emu_contrast(void)
+{
+	return contrast;
+}
+
+/* The panel is mounted so that A1/C8 (the init defaults) show column 0 on the left
+ * and page 0 at the top. */
+static int pixel(int x, int y)
+{
+	if (!disp_on)
+		return 0;
+	int c = seg_remap ? x : (W-1) - x;
+	int r = com_dec ? y : (SSD1306_LCDHEIGHT-1) - y;
+	return (gram[r/8][c] >> (r&7)) & 1;
+}
+
+int emu_shot_pbm(const char *fn)
+{
+	FILE *f = fopen(fn, "wb");
+	if (!f)
+		return 1;
+	fprintf(f, "P4\n%d %d\n", W, SSD1306_LCDHEIGHT);
+	for (int y = 0; y < SSD1306_LCDHEIGHT; y++) {
+		for (int x = 0; x < W; x += 8) {
+			uint8_t b = 0;
+			for (int i = 0; i < 8; i++)
+				b |= pixel(x+i, y) << (7-i);
+			fputc(b, f);
+		}
+	}
+	return fclose(f) ? 1 : 0;
+}
+
+void emu_show(FILE *f)
+{
+	static const char *const half[4] = { " ", "\xe2\x96\x80", "\xe2\x96\x84", "\xe2\x96\x88" };
+	for (int y = 0; y < SSD1306_LCDHEIGHT; y += 2) {
+		fputc('|', f);
+		for (int x = 0; x < W; x++)
+			fputs(half[pixel(x, y) | (pixel(x, y+1) << 1)], f);
+		fputs("|\n", f);
+	}
+}
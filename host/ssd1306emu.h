@@ -0,0 +1,24 @@
+#pragma once
+#include <stdio.h>
+
+/* Host SSD1306 model, it stands in for swi2c.c under the real SSD1306.c. */
+
+struct emu_stats {
+	unsigned long xfers; /* START conditions addressed to the display */
+	unsigned long cmd_bytes;
+	unsigned long data_bytes;
+	unsigned long bus_bytes; /* everything on the wire, address and control bytes too */
+};
+
+void emu_get_stats(struct emu_stats *s);
+void emu_reset_stats(void);
+/* Writes what the panel shows (blank while it is off) as a binary PBM, returns 1 on error. */
+int emu_shot_pbm(const char *fn);
+/* Prints the panel as text, two pixel rows per line. */
+void emu_show(FILE *f);
+int emu_display_on(void);
+/* Unplugging makes it NAK its address, plugging it back in is a power on reset. */
+void emu_plug(int in);
+/* NAK the nth byte (the address included) from now on. */
+void emu_nak_after(unsigned long n);
+int emu_contrast(void);
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Host tool: runs tui.c, lcd.c and SSD1306.c on top of ssd1306emu.c, with the
+ * buttons, clock and sensor faked and driven by a script ("make tuiemu"):
+ *
+ *	host/tuiemu [script]	(stdin without one)
+ *
+ * Each mini_mainloop() call is one 5Hz tick, every fifth one is also the 1Hz pulse.
+ * The script is read whenever the firmware would sleep and nothing is queued:
+ *	key OK|NEXT|PREV	press a button (takes one tick)
+ *	run N			run N ticks without input
+ *	shot file.pbm		screenshot of the panel
+ *	show			print the panel as text
+ *	stats [reset]		I2C transactions and bytes sent to the display
+ *	temp T [RH]		sensor reading, in the sensor's units (tenths)
+ *	nosensor		make the sensor stop answering
+ *	unplug, plug		take the display off the bus and put it back (power cycled)
+ *	nak N			the display NAKs the Nth byte from now
+ *	idle on|dim|off		what timer.c would set after the idle timeouts
+ *	time YYYY MM DD hh mm ss
+ * Lines starting with # are comments, the end of the script exits.
+ * "make tuiemu-check" runs the scripts in host/tests against their expected output. */
+
+#include "main.h"
+#include "buttons.h"
+#include "timer.h"
+#include "lcd.h"
+#include "tui.h"
+#include "ssd1306emu.h"
+#include "config.h"
+
+static FILE *script;
+static unsigned long script_line;
+static uint8_t pending_key;
+static unsigned long run_ticks;
+static unsigned long ticks;
+
+static uint8_t tick_5hzp, tick_1hzp;
+static uint8_t t5hz_cnt;
+static uint32_t uptime;
+static uint32_t clock_lin;
+
+static int16_t sensor_v[2] = { 215, 453 };
+static uint8_t sensor_ok = 1;
+
+/* The ciface lib.c helpers the TUI uses. */
+uint8_t uint2str(unsigned char *buf, uint16_t val)
+{
+	return sprintf((char*)buf, "%u", (unsigned)val);
+}
+
+uint8_t luint2str(unsigned char *buf, uint32_t val)
+{
+	return sprintf((char*)buf, "%lu", (unsigned long)val);
+}
+
+/* buttons.c */
+void buttons_init(void)
+{
+}
+
+uint8_t buttons_get(void)
+{
+	uint8_t k = pending_key;
+	pending_key = 0;
+	return k;
+}
+
+uint8_t buttons_get_v(void)
+{
+	return pending_key;
+}
+
+/* timer.c */
+uint32_t timer_get(void)
+{
+	return uptime;
+}
+
+uint8_t timer_get_1hzp(void)
+{
+	return tick_1hzp;
+}
+
+uint8_t timer_get_5hzp(void)
+{
+	return tick_5hzp;
+}
+
+uint8_t timer_get_5hz_cnt(void)
+{
+	return t5hz_cnt;
+}
+
+void timer_activity(void)
+{
+}
+
+void timer_delay_ms(uint8_t ms)
+{
+}
+
+void timer_set_time(struct mtm *tm)
+{
+	clock_lin = mtm2linear(tm);
+}
+
+void timer_get_time(struct mtm *tm)
+{
+	linear2mtm(tm, clock_lin);
+}
+
+uint8_t timer_time_isvalid(void)
+{
+	return 1;
+}
+
+/* rtc.c */
+uint8_t rtc_valid(void)
+{
+	return 1;
+}
+
+/* sensor.c, one AMS2302-like sensor */
+PGM_P sensor_get(uint8_t idx, int16_t *v, uint8_t max_age)
+{
+	if (!sensor_ok)
+		return PSTR("NORESP");
+	v[0] = sensor_v[0];
+	v[1] = sensor_v[1];
+	return NULL;
+}
+
+uint8_t sensor_nvals(uint8_t idx)
+{
+	return 2;
+}
+
+uint8_t sensor_scale(uint8_t idx)
+{
+	return 1;
+}
+
+PGM_P sensor_units(uint8_t idx, uint8_t vi)
+{
+	return vi ? PSTR("RH[%]") : PSTR("T[C]");
+}
+
+void make_v10_str(unsigned char *buf, int16_t t10)
+{
+	sprintf((char*)buf, "%s%d.%d", t10 < 0 ? "-" : "", abs(t10) / 10, abs(t10) % 10);
+}
+
+void sensor_val_str(unsigned char *buf, int16_t v, uint8_t scale)
+{
+	if (scale)
+		make_v10_str(buf, v);
+	else
+		sprintf((char*)buf, "%d", v);
+}
+
+/* logger.c and the FAT library */
+uint8_t logger_sd_status(void)
+{
+	return 2;
+}
+
+PGM_P logger_sd_err(void)
+{
+	return NULL;
+}
+
+PGM_P fat_get_last_error(void)
+{
+	return NULL;
+}
+
+uint16_t logger_buf_stat(void)
+{
+	return 0;
+}
+
+uint32_t logger_log_size(void)
+{
+	return 123456;
+}
+
+void logger_sd_eject(uint8_t eject)
+{
+}
+
+static void script_error(const char *msg)
+{
+	fprintf(stderr, "line %lu: %s\n", script_line, msg);
+	exit(1);
+}
+
+static void print_stats(void)
+{
+	struct emu_stats s;
+	emu_get_stats(&s);
+	printf("tick %lu: %lu xfers, %lu cmd bytes, %lu data bytes, %lu bus bytes (%lu us at 400kHz), display %s contrast %d\n",
+		ticks, s.xfers, s.cmd_bytes, s.data_bytes, s.bus_bytes,
+		(s.bus_bytes * 9 + s.xfers * 2) * 10 / 4,
+		emu_display_on() ? "on" : "off", emu_contrast());
+}
+
+/* Runs script lines until one of them needs ticks to pass. */
+static void script_step(void)
+{
+	char line[256];
+	while (fgets(line, sizeof(line), script)) {
+		char a[200];
+		int n[6];
+		script_line++;
+		if ((line[0] == '#')||(sscanf(line, "%199s", a) != 1))
+			continue;
+		if (!strcmp(a, "key")) {
+			if (sscanf(line, "key %199s", a) != 1)
+				script_error("key what?");
+			if (!strcmp(a, "OK")) pending_key = BUTTON_OK;
+			else if (!strcmp(a, "NEXT")) pending_key = BUTTON_NEXT;
+			else if (!strcmp(a, "PREV")) pending_key = BUTTON_PREV;
+			else script_error("unknown key");
+			return;
+		} else if (!strcmp(a, "run")) {
+			if ((sscanf(line, "run %d", &n[0]) != 1)||(n[0] < 1))
+				script_error("run how long?");
+			run_ticks = n[0];
+			return;
+		} else if (!strcmp(a, "shot")) {
+			if (sscanf(line, "shot %199s", a) != 1)
+				script_error("shot to where?");
+			if (emu_shot_pbm(a))
+				script_error("cannot write the screenshot");
+		} else if (!strcmp(a, "show")) {
+			emu_show(stdout);
+		} else if (!strcmp(a, "stats")) {
+			print_stats();
+			if ((sscanf(line, "stats %199s", a) == 1)&&(!strcmp(a, "reset")))
+				emu_reset_stats();
+		} else if (!strcmp(a, "temp")) {
+			int c = sscanf(line, "temp %d %d", &n[0], &n[1]);
+			if (c < 1)
+				script_error("temp what?");
+			sensor_v[0] = n[0];
+			if (c > 1) sensor_v[1] = n[1];
+			sensor_ok = 1;
+		} else if (!strcmp(a, "unplug")) {
+			emu_plug(0);
+		} else if (!strcmp(a, "plug")) {
+			emu_plug(1);
+		} else if (!strcmp(a, "nak")) {
+			if ((sscanf(line, "nak %d", &n[0]) != 1)||(n[0] < 1))
+				script_error("nak which byte?");
+			emu_nak_after(n[0]);
+		} else if (!strcmp(a, "idle")) {
+			if (sscanf(line, "idle %199s", a) != 1)
+				script_error("idle how?");
+			if (!strcmp(a, "on")) lcd_idle(LCD_ON);
+			else if (!strcmp(a, "dim")) lcd_idle(LCD_DIM);
+			else if (!strcmp(a, "off")) lcd_idle(LCD_OFF);
+			else script_error("idle on, dim or off");
+		} else if (!strcmp(a, "nosensor")) {
+			sensor_ok = 0;
+		} else if (!strcmp(a, "time")) {
+			struct mtm tm;
+			if (sscanf(line, "time %d %d %d %d %d %d", &n[0], &n[1], &n[2], &n[3], &n[4], &n[5]) != 6)
+				script_error("time YYYY MM DD hh mm ss");
+			tm.year = n[0] - TIME_EPOCH_YEAR;
+			tm.month = n[1];
+			tm.day = n[2];
+			tm.hour = n[3];
+			tm.min = n[4];
+			tm.sec = n[5];
+			clock_lin = mtm2linear(&tm);
+		} else {
+			script_error("unknown command");
+		}
+	}
+	exit(0);
+}
+
+static void tick(void)
+{
+	ticks++;
+	tick_5hzp = 1;
+	t5hz_cnt++;
+	tick_1hzp = ((ticks % 5) == 0);
+	if (tick_1hzp) {
+		uptime++;
+		clock_lin++;
+	}
+}
+
+/* main.c: this is where the firmware would sleep in timer_run. */
+void cli_bgloop(void)
+{
+	lcd_flush();
+	if (!run_ticks)
+		script_step();
+	if (run_ticks)
+		run_ticks--;
+	tick();
+	ssd1306_run();
+}
+
+void mini_mainloop(void)
+{
+	cli_bgloop();
+}
+
+int main(int argc, char **argv)
+{
+	script = stdin;
+	if (argc > 1) {
+		script = fopen(argv[1], "r");
+		if (!script) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	cfg_init();
+	lcd_init();
+	tui_init();
+	for (;;) {
+		mini_mainloop();
+		tui_run();
+	}
+}
@@ -3,16 +3,37 @@
 * Author:   Peter Fleury <pfleury@gmx.ch>  http://jump.to/fleury
 * File:     $Id: twimaster.c,v 1.3 2005/07/02 11:14:21 Peter Exp $
 * Software: AVR-GCC 3.4.3 / avr-libc 1.2.3
-* Target:   any AVR device with hardware TWI 
+* Target:   any AVR device with hardware TWI
 * Usage:    API compatible with I2C Software Library i2cmaster.h
 **************************************************************************/
-/* Hacked By Urjaman */
+/* Hacked By Urjaman, into an interrupt driven transaction queue. */
 
 #include "main.h"
 #include "i2c.h"
 #include <util/twi.h>
 /* I2C clock in Hz - DS1307 is max 100Khz */
 #define SCL_CLOCK  100000L
+/* Transactions with I2C_F_FAST (the OLED stream) run at 400kHz. */
+#define SCL_CLOCK_FAST 400000L
+#define TWBR_STD (((F_CPU/SCL_CLOCK)-16)/2)
+#define TWBR_FAST (((F_CPU/SCL_CLOCK_FAST)-16)/2)
+
+#define TWCR_GO ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+
+#define I2C_QLEN 4
+static struct i2c_xfer *i2c_q[I2C_QLEN];
+static uint8_t i2c_qr, i2c_qw;
+static struct i2c_xfer * volatile i2c_cur;
+static uint8_t i2c_wi, i2c_ri;
+static uint16_t i2c_stats[I2C_X_STATS];
+
+/* The OLED stream, see i2c_tx_begin. */
+#define TX_RING 32
+static uint8_t tx_ring[TX_RING];
+static volatile uint8_t tx_r, tx_w;
+static volatile uint8_t tx_open;
+static volatile uint8_t tx_parked;
+static struct i2c_xfer tx_x = { .status = I2C_X_OK };
 
 /*************************************************************************
  Initialization of the I2C bus interface. Need to be called only once
@@ -20,94 +41,194 @@
 void i2c_init(void) {
 	/* initialize TWI clock: 100 kHz clock, TWPS = 0 => prescaler = 1 */
 	TWSR = 0;                         /* no prescaler */
-	TWBR = ((F_CPU/SCL_CLOCK)-16)/2;  /* must be > 10 for stable operation */
+	TWBR = TWBR_STD;  /* must be > 10 for stable operation */
 }
 
-/*************************************************************************	
-  Issues a start condition and sends address and transfer direction.
-  return 0 = device accessible, 1= failed to access device (start)
-  2= device doesnt ack address. You never need to i2c_stop after failed start.
-*************************************************************************/
-unsigned char i2c_start(unsigned char address) {
-	uint8_t   twst;
-	// send START condition
-	TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
-	// wait until transmission completed
-	while(!(TWCR & (1<<TWINT)));
-	// check value of TWI Status Register. Mask prescaler bits.
-	twst = TW_STATUS & 0xF8;
-	if ( (twst != TW_START) && (twst != TW_REP_START)) return 1;
-	// send device address
-	TWDR = address;
-	TWCR = (1<<TWINT) | (1<<TWEN);
-	// wail until transmission completed and ACK/NACK has been received
-	while(!(TWCR & (1<<TWINT)));
-	// check value of TWI Status Register. Mask prescaler bits.
-	twst = TW_STATUS & 0xF8;
-	if ( (twst != TW_MT_SLA_ACK) && (twst != TW_MR_SLA_ACK) ) {
-		i2c_stop();
-		return 2;
+static void i2c_start_xfer(struct i2c_xfer *x) {
+	/* A STOP still going out must not see the bit rate change. */
+	while (TWCR & (1<<TWSTO));
+	TWBR = (x->flags & I2C_F_FAST) ? TWBR_FAST : TWBR_STD;
+	x->status = I2C_X_BUSY;
+	TWCR = TWCR_GO | (1<<TWSTA);
+}
+
+static void i2c_finish(struct i2c_xfer *x, uint8_t st) {
+	TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+	i2c_stats[st]++;
+	x->status = st;
+	if (x->done) x->done(x);
+	struct i2c_xfer *n = NULL;
+	uint8_t r = i2c_qr;
+	if (r != i2c_qw) {
+		n = i2c_q[r];
+		i2c_qr = (r+1) & (I2C_QLEN-1);
+		i2c_start_xfer(n);
 	}
-	return 0;
+	i2c_cur = n;
 }
 
-/*************************************************************************
- Issues a repeated start condition and sends address and transfer direction 
- Input:   address and transfer direction of I2C device
- Return:  0 device accessible
-          1 failed to access device
-*************************************************************************/
-unsigned char i2c_rep_start(unsigned char address) {
-	return i2c_start( address );
+ISR(TWI_vect) {
+	struct i2c_xfer *x = i2c_cur;
+	uint8_t st;
+	switch (TW_STATUS & 0xF8) {
+	case TW_START:
+		i2c_wi = 0;
+		i2c_ri = 0;
+		/* Reads without a register write start with SLA+R, everything else with SLA+W. */
+		TWDR = ((!x->wlen) && (x->rlen) && (!(x->flags & I2C_F_STREAM))) ? x->addr | 1 : x->addr;
+		goto cont;
+	case TW_REP_START:
+		TWDR = x->addr | 1;
+		goto cont;
+	case TW_MT_SLA_ACK:
+	case TW_MT_DATA_ACK:
+		if (x->flags & I2C_F_STREAM) {
+			x->status = I2C_X_STREAMING;
+			if (tx_r != tx_w) {
+				uint8_t r = tx_r;
+				TWDR = tx_ring[r];
+				tx_r = (r+1) & (TX_RING-1);
+				goto cont;
+			}
+			if (tx_open) {
+				/* Leave TWINT set, that stalls the bus until we're kicked again. */
+				tx_parked = 1;
+				TWCR = (1<<TWEN);
+				return;
+			}
+			st = I2C_X_OK;
+			break;
+		}
+		if (i2c_wi < x->wlen) {
+			TWDR = x->wbuf[i2c_wi++];
+			goto cont;
+		}
+		if (x->rlen) {
+			TWCR = TWCR_GO | (1<<TWSTA);
+			return;
+		}
+		st = I2C_X_OK;
+		break;
+	case TW_MR_DATA_ACK:
+		x->rbuf[i2c_ri++] = TWDR;
+		/* fall through */
+	case TW_MR_SLA_ACK:
+		if (!x->rlen) {
+			st = I2C_X_OK;
+			break;
+		}
+		/* ACK all but the last byte */
+		if ((i2c_ri+1) < x->rlen) TWCR = TWCR_GO | (1<<TWEA);
+		else TWCR = TWCR_GO;
+		return;
+	case TW_MR_DATA_NACK:
+		x->rbuf[i2c_ri++] = TWDR;
+		st = I2C_X_OK;
+		break;
+	case TW_MT_SLA_NACK:
+	case TW_MR_SLA_NACK:
+	case TW_MT_DATA_NACK:
+		st = I2C_X_NAK;
+		break;
+	default: /* bus error or lost arbitration */
+		st = I2C_X_ERR;
+		break;
+	}
+	i2c_finish(x, st);
+	return;
+cont:
+	TWCR = TWCR_GO;
 }
 
 /*************************************************************************
- Terminates the data transfer and releases the I2C bus
+ Queue a transaction: write wlen bytes from wbuf, then (with a repeated
+ start) read rlen bytes into rbuf. Both buffers and x itself must stay
+ valid until x->status has no I2C_X_PENDING, at which point done (if any)
+ has been called from the ISR. Returns 1 if the queue is full.
 *************************************************************************/
-void i2c_stop(void) {
-	/* send stop condition */
-	TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
-	// wait until stop condition is executed and bus released
-	while(TWCR & (1<<TWSTO));
+uint8_t i2c_submit(struct i2c_xfer *x) {
+	uint8_t rv = 0;
+	cli();
+	if (!i2c_cur) {
+		i2c_cur = x;
+		i2c_start_xfer(x);
+	} else {
+		uint8_t w = i2c_qw;
+		uint8_t nw = (w+1) & (I2C_QLEN-1);
+		if (nw == i2c_qr) {
+			rv = 1;
+		} else {
+			x->status = I2C_X_QUEUED;
+			i2c_q[w] = x;
+			i2c_qw = nw;
+		}
+	}
+	sei();
+	return rv;
 }
 
-/*************************************************************************
-  Send one byte to I2C device
-  Input:    byte to be transfered
-  Return:   0 write successful 
-            1 write failed
-*************************************************************************/
-unsigned char i2c_write( unsigned char data ) {
-	uint8_t twst;
-	// send data to the previously addressed device
-	TWDR = data;
-	TWCR = (1<<TWINT) | (1<<TWEN);
-	// wait until transmission completed
-	while(!(TWCR & (1<<TWINT)));
-	// check value of TWI Status Register. Mask prescaler bits
-	twst = TW_STATUS & 0xF8;
-	if( twst != TW_MT_DATA_ACK) return 1;
+/* Sleep (idle) until x is finished, returns values per the old i2c_start(). */
+uint8_t i2c_wait(struct i2c_xfer *x) {
+	while (x->status & I2C_X_PENDING) sleep_mode();
+	if (x->status == I2C_X_NAK) return 2;
+	if (x->status == I2C_X_ERR) return 1;
 	return 0;
 }
 
-/*************************************************************************
- Read one byte from the I2C device, request more data from device 
- Return:  byte read from I2C device
-*************************************************************************/
-unsigned char i2c_readAck(void) {
-	TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWEA);
-	while(!(TWCR & (1<<TWINT)));    
-	return TWDR;
+uint8_t i2c_busy(void) {
+	return i2c_cur != NULL;
+}
+
+uint16_t i2c_stat(uint8_t st) {
+	return i2c_stats[st];
 }
 
 /*************************************************************************
- Read one byte from the I2C device, read is followed by a stop condition 
- Return:  byte read from I2C device
+ The OLED (SSD1306_HWI2C) stream: one write-only transaction at a time whose
+ data is produced while it is being sent. i2c_tx_begin waits for the address
+ to be acked, after that the bytes go through a small ring that the ISR drains.
+ When the ring runs empty the ISR just holds the bus (SCL low) until more data
+ or i2c_tx_end comes along.
 *************************************************************************/
-unsigned char i2c_readNak(void) {
-	TWCR = (1<<TWINT) | (1<<TWEN);
-	while(!(TWCR & (1<<TWINT)));
-	return TWDR;
+static void i2c_tx_kick(void) {
+	cli();
+	if (tx_parked) {
+		tx_parked = 0;
+		TWCR = (1<<TWEN) | (1<<TWIE);
+	}
+	sei();
+}
+
+/* Return values per i2c_start(). */
+uint8_t i2c_tx_begin(uint8_t addr) {
+	i2c_wait(&tx_x);
+	tx_x.addr = addr;
+	tx_x.flags = I2C_F_STREAM | I2C_F_FAST;
+	tx_r = 0;
+	tx_w = 0;
+	tx_open = 1;
+	tx_parked = 0;
+	while (i2c_submit(&tx_x)) sleep_mode();
+	while ((tx_x.status == I2C_X_QUEUED)||(tx_x.status == I2C_X_BUSY));
+	if (tx_x.status == I2C_X_NAK) return 2;
+	return tx_x.status == I2C_X_STREAMING ? 0 : 1;
+}
+
+/* Returns 1 if the transfer has failed (and was already stopped). */
+uint8_t i2c_tx_byte(uint8_t d) {
+	uint8_t w = tx_w;
+	uint8_t nw = (w+1) & (TX_RING-1);
+	while ((nw == tx_r) && (tx_x.status == I2C_X_STREAMING));
+	if (tx_x.status != I2C_X_STREAMING) return 1;
+	tx_ring[w] = d;
+	tx_w = nw;
+	i2c_tx_kick();
+	return 0;
+}
+
+void i2c_tx_end(void) {
+	tx_open = 0;
+	i2c_tx_kick();
 }
 
 /************************************************************************
@@ -115,21 +236,15 @@ unsigned char i2c_readNak(void) {
  starting with reg into buf from dev. Return values per i2c_start().
 ************************************************************************/
 uint8_t i2c_read_regs(uint8_t dev, uint8_t reg, uint8_t cnt, uint8_t* buf) {
-	uint8_t x;
-	if ((x = i2c_start(dev&0xFE))) return x;
-	if (i2c_write(reg)) goto fail_exit;
-	if ((x = i2c_rep_start(dev|0x01))) return x;
-	uint8_t offset=0;
-	while (cnt>1) {
-		buf[offset++] = i2c_readAck();
-		cnt--;
-	}
-	if (cnt) buf[offset] = i2c_readNak();
-	i2c_stop();
-	return 0;
-fail_exit:
-	i2c_stop();
-	return 1;
+	struct i2c_xfer x = {
+		.addr = dev & 0xFE,
+		.wbuf = &reg,
+		.wlen = 1,
+		.rbuf = buf,
+		.rlen = cnt,
+	};
+	if (i2c_submit(&x)) return 1;
+	return i2c_wait(&x);
 }
 
 
@@ -138,17 +253,16 @@ fail_exit:
  starting with reg into dev from buf. Return values per i2c_start().
 ************************************************************************/
 uint8_t i2c_write_regs(uint8_t dev, uint8_t reg, uint8_t cnt, uint8_t* buf) {
-	uint8_t x;
-	if ((x = i2c_start(dev&0xFE))) return x;
-	if (i2c_write(reg)) goto fail_exit;
-	for (uint8_t i=0;i<cnt;i++) {
-		if (i2c_write(buf[i])) goto fail_exit;
-	}
-	i2c_stop();
-	return 0;
-fail_exit:
-	i2c_stop();
-	return 1;
+	uint8_t wb[cnt+1];
+	wb[0] = reg;
+	memcpy(wb+1, buf, cnt);
+	struct i2c_xfer x = {
+		.addr = dev & 0xFE,
+		.wbuf = wb,
+		.wlen = cnt+1,
+	};
+	if (i2c_submit(&x)) return 1;
+	return i2c_wait(&x);
 }
 
 
@@ -1,13 +1,41 @@
 #pragma once
 
+/* A queued transaction: write wlen bytes, then read rlen bytes. */
+struct i2c_xfer {
+	uint8_t addr; /* 8-bit address, R/W bit 0 */
+	uint8_t flags;
+	uint8_t wlen;
+	uint8_t rlen;
+	const uint8_t *wbuf;
+	uint8_t *rbuf;
+	void (*done)(struct i2c_xfer *x); /* called from the ISR, may be NULL */
+	volatile uint8_t status;
+};
+
+#define I2C_F_FAST 1 /* 400kHz */
+#define I2C_F_STREAM 2 /* i2c_tx_* internal */
+
+/* Final status values, also the i2c_stat indexes. */
+#define I2C_X_OK 0
+#define I2C_X_NAK 1
+#define I2C_X_ERR 2
+#define I2C_X_STATS 3
+/* In progress status values */
+#define I2C_X_PENDING 0x80
+#define I2C_X_QUEUED 0x80
+#define I2C_X_BUSY 0x81
+#define I2C_X_STREAMING 0x82
+
 void i2c_init(void);
-unsigned char i2c_start(unsigned char address);
-unsigned char i2c_rep_start(unsigned char address);
-void i2c_stop(void);
-unsigned char i2c_write( unsigned char data );
-unsigned char i2c_readAck(void);
-unsigned char i2c_readNak(void);
-// Higher level functions (by urjaman):
+uint8_t i2c_submit(struct i2c_xfer *x);
+uint8_t i2c_wait(struct i2c_xfer *x);
+uint8_t i2c_busy(void);
+uint16_t i2c_stat(uint8_t st);
+// Interrupt driven write-only stream (OLED):
+uint8_t i2c_tx_begin(uint8_t addr);
+uint8_t i2c_tx_byte(uint8_t d);
+void i2c_tx_end(void);
+// Higher level functions (by urjaman), these sleep until done:
 uint8_t i2c_read_regs(uint8_t dev, uint8_t reg, uint8_t cnt, uint8_t* buf);
 uint8_t i2c_write_regs(uint8_t dev, uint8_t reg, uint8_t cnt, uint8_t* buf);
 uint8_t i2c_read_reg(uint8_t dev, uint8_t reg, uint8_t *val);
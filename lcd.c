@@ -19,22 +19,51 @@
 
 #include "main.h"
 #include "lcd.h"
+#include <util/crc16.h>
 
 
 #define lf_height 2
 #define lf_width 1
 
 static uint8_t lcd_char_y, lcd_char_x;
-static uint8_t disp_on;
-
-void lcd_idle(uint8_t idle) {
-	if (disp_on == !idle) return;
-	if (idle) {
+static uint8_t disp_state = LCD_OFF;
+static uint8_t lcd_changes;
+static uint8_t lcd_damage;
+
+void lcd_idle(uint8_t state) {
+	uint8_t prev = disp_state;
+	if (prev == state) return;
+	disp_state = state;
+	if (state == LCD_OFF) {
 		ssd1306_command(SSD1306_DISPLAYOFF);
-	} else {
-		ssd1306_command(SSD1306_DISPLAYON);
+		return;
 	}
-	disp_on = !idle;
+	ssd1306_contrast(state == LCD_DIM ? SSD1306_DIM_CONTRAST : SSD1306_DEF_CONTRAST);
+	/* Nothing probed it while off, so it may have been power cycled meanwhile. */
+	if (prev == LCD_OFF) lcd_resync();
+}
+
+uint8_t lcd_is_on(void) {
+	return disp_state != LCD_OFF;
+}
+
+/* Count of cells actually sent since the last call. */
+uint8_t lcd_get_changes(void) {
+	uint8_t c = lcd_changes;
+	lcd_changes = 0;
+	return c;
+}
+
+uint8_t lcd_get_damage(void) {
+	uint8_t d = lcd_damage;
+	lcd_damage = 0;
+	return d;
+}
+
+/* Failed writes: the shadow was already invalidated, so a redraw sends it again.
+ * While the display is gone there is no point, the resync redraws everything. */
+static void lcd_write_failed(void) {
+	if (ssd1306_present()) lcd_damage = 1;
 }
 
 static uint8_t flip_bits(uint8_t bits) {
@@ -44,18 +73,139 @@ static uint8_t flip_bits(uint8_t bits) {
 	return bits;
 }
 
-static void lcd_font2x(const uint8_t *ib, uint8_t w)
+/* Dirty region tracking: the screen is split into cells of LCD_CELLW columns by one page,
+ * and we remember a CRC of what was last sent to each cell (a full shadow would be 1k).
+ * Text is gathered left to right into a pending cell, which is only sent if it differs.
+ * Cells that are written partially are sent as-is and forget their CRC. */
+#define LCD_CELLW 16
+#define LCD_CELLS (LCDWIDTH/LCD_CELLW)
+
+static uint16_t lcd_shadow[LCD_MAXY][LCD_CELLS];
+static uint8_t lcd_shadow_ok[LCD_MAXY]; /* bitmap of cells with a valid CRC */
+
+static uint8_t lcd_pend[lf_height][LCD_CELLW];
+static uint8_t lcd_pend_x = 0xFF; /* first column of the cell, 0xFF = nothing pending */
+static uint8_t lcd_pend_y;
+static uint8_t lcd_pend_s, lcd_pend_e; /* written columns within the cell, [s,e) */
+
+static uint16_t lcd_cell_crc(const uint8_t *d)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i=0; i < LCD_CELLW; i++) crc = _crc_ccitt_update(crc, d[i]);
+	return crc;
+}
+
+static void lcd_shadow_inval(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
+{
+	uint8_t m = 0;
+	if ((!w)||(!h)) return;
+	for (uint8_t c = x / LCD_CELLW; c <= (x+w-1) / LCD_CELLW; c++) m |= _BV(c);
+	for (uint8_t p = y; (p < y+h) && (p < LCD_MAXY); p++) lcd_shadow_ok[p] &= ~m;
+}
+
+static void lcd_shadow_blank(void)
+{
+	uint8_t z[LCD_CELLW];
+	memset(z, 0, sizeof(z));
+	uint16_t crc = lcd_cell_crc(z);
+	for (uint8_t p=0; p < LCD_MAXY; p++) {
+		for (uint8_t c=0; c < LCD_CELLS; c++) lcd_shadow[p][c] = crc;
+		lcd_shadow_ok[p] = (1 << LCD_CELLS) - 1;
+	}
+}
+
+/* The display is in vertical addressing mode, so the changed cells next to each
+ * other on a line go out as one transaction: the box is opened to the right edge
+ * and the columns (both pages of each) are streamed into it. */
+static uint8_t lcd_strm_x = 0xFF; /* next column in the open transaction, 0xFF = none */
+static uint8_t lcd_strm_y;
+
+static void lcd_stream_end(void)
+{
+	if (lcd_strm_x == 0xFF) return;
+	lcd_strm_x = 0xFF;
+	ssd1306_end();
+}
+
+static void lcd_cell_out(void)
+{
+	uint8_t x = lcd_pend_x;
+	if (x == 0xFF) return;
+	lcd_pend_x = 0xFF;
+	uint8_t s = lcd_pend_s;
+	uint8_t w = lcd_pend_e - s;
+	uint8_t c = x / LCD_CELLW;
+	uint8_t m = _BV(c);
+	uint8_t y = lcd_pend_y;
+	uint8_t h = (y + lf_height) > LCD_MAXY ? LCD_MAXY - y : lf_height;
+	uint8_t send = 0;
+	for (uint8_t p=0; p < h; p++) {
+		if (w == LCD_CELLW) {
+			uint16_t crc = lcd_cell_crc(lcd_pend[p]);
+			if ((lcd_shadow_ok[y+p] & m) && (lcd_shadow[y+p][c] == crc)) continue;
+			lcd_shadow[y+p][c] = crc;
+			lcd_shadow_ok[y+p] |= m;
+		} else {
+			lcd_shadow_ok[y+p] &= ~m;
+		}
+		send = 1;
+	}
+	if (!send) {
+		lcd_stream_end();
+		return;
+	}
+	lcd_changes++;
+	x += s;
+	if ((lcd_strm_x != x) || (lcd_strm_y != y)) {
+		lcd_stream_end();
+		ssd1306_setbox(x, y, LCDWIDTH - x, h);
+		if (ssd1306_start()) goto fail;
+		lcd_strm_y = y;
+	}
+	for (uint8_t i=s; i < s+w; i++) {
+		for (uint8_t p=0; p < h; p++) {
+			if (ssd1306_data(lcd_pend[p][i])) goto fail;
+		}
+	}
+	lcd_strm_x = x + w;
+	return;
+fail:
+	/* The failed write already stopped the bus. */
+	lcd_strm_x = 0xFF;
+	lcd_shadow_inval(x, y, LCD_CELLW, h);
+	lcd_write_failed();
+}
+
+void lcd_flush(void)
 {
-	uint8_t ob[LCDWIDTH*2]; /* 2 lines */
-	uint8_t ws = w * lf_width;
+	lcd_cell_out();
+	lcd_stream_end();
+}
 
-	if (ws >= LCDWIDTH) {
-		w = LCDWIDTH / lf_width;
-		ws = w * lf_width;
+/* The column is in the display bit order already. */
+static void lcd_pend_col(uint8_t hi, uint8_t lo)
+{
+	uint8_t x = lcd_char_x;
+	if (x >= LCDWIDTH) return;
+	lcd_char_x = x + 1;
+	uint8_t cx = x & ~(LCD_CELLW-1);
+	uint8_t ci = x & (LCD_CELLW-1);
+	if ((lcd_pend_x != cx) || (lcd_pend_y != lcd_char_y) || (lcd_pend_e != ci)) {
+		lcd_cell_out();
+		lcd_pend_x = cx;
+		lcd_pend_y = lcd_char_y;
+		lcd_pend_s = ci;
 	}
+	lcd_pend[0][ci] = hi;
+	lcd_pend[1][ci] = lo;
+	lcd_pend_e = ci + 1;
+	if (lcd_pend_e == LCD_CELLW) lcd_cell_out();
+}
 
+/* The font is pre-expanded (mfont2x.c), this is for lcd_write_dwb. */
+static void lcd_font2x(const uint8_t *ib, uint8_t w)
+{
 	for (uint8_t i=0; i<w; i++) {
-		uint8_t is = i * lf_width;
 		uint8_t d = ib[i];
 		uint8_t hi = 0;
 		uint8_t lo = 0;
@@ -65,90 +215,99 @@ static void lcd_font2x(const uint8_t *ib, uint8_t w)
 			if (d & _BV(4+b)) hi |= 0xC0;
 			if (d & _BV(b)) lo |= 0xC0;
 		}
-		for (uint8_t wi = 0; wi < lf_width; wi++) {
-			ob[is+wi] = hi;
-			ob[ws+is+wi] = lo;
-		}
-
+		hi = flip_bits(hi);
+		lo = flip_bits(lo);
+		for (uint8_t wi = 0; wi < lf_width; wi++) lcd_pend_col(hi, lo);
 	}
-	lcd_write_block(ob, ws, 2);
 }
 
 
 void lcd_write_block_P(const PGM_P buffer, uint8_t w, uint8_t h)
 {
-	uint8_t ye = lcd_char_y+h;
-	uint8_t we = lcd_char_x+w;
+	lcd_flush();
+	lcd_shadow_inval(lcd_char_x, lcd_char_y, w, h);
 	ssd1306_setbox(lcd_char_x, lcd_char_y, w, h);
-	if (ssd1306_start()) return;
-	for (uint8_t y=lcd_char_y;y<ye;y++) {
-		for (uint8_t x=lcd_char_x;x<we;x++) {
-			uint8_t d = pgm_read_byte(buffer);
-			buffer++;
-			if (ssd1306_data(flip_bits(d))) return;
+	if (ssd1306_start()) goto fail;
+	/* The buffer goes by rows, the display (vertical addressing) by columns. */
+	for (uint8_t x=0;x<w;x++) {
+		for (uint8_t y=0;y<h;y++) {
+			uint8_t d = pgm_read_byte(buffer + y*w + x);
+			if (ssd1306_data(flip_bits(d))) goto fail;
 		}
 	}
 	ssd1306_end();
 	lcd_char_x += w;
 	if (lcd_char_x > (LCD_MAXX*LCD_CHARW)) lcd_char_x = (LCD_MAXX*LCD_CHARW); /* saturate */
-
+	return;
+fail:
+	lcd_write_failed();
 }
 
 void lcd_write_block(const uint8_t *buffer, uint8_t w, uint8_t h)
 {
-	uint8_t ye = lcd_char_y+h;
-	uint8_t we = lcd_char_x+w;
+	lcd_flush();
+	lcd_shadow_inval(lcd_char_x, lcd_char_y, w, h);
 	ssd1306_setbox(lcd_char_x, lcd_char_y, w, h);
-	if (ssd1306_start()) return;
-	for (uint8_t y=lcd_char_y;y<ye;y++) {
-		for (uint8_t x=lcd_char_x;x<we;x++) {
-			if (ssd1306_data(flip_bits(*buffer++))) return;
+	if (ssd1306_start()) goto fail;
+	/* The buffer goes by rows, the display (vertical addressing) by columns. */
+	for (uint8_t x=0;x<w;x++) {
+		for (uint8_t y=0;y<h;y++) {
+			if (ssd1306_data(flip_bits(buffer[y*w + x]))) goto fail;
 		}
 	}
 	ssd1306_end();
 	lcd_char_x += w;
-
+	return;
+fail:
+	lcd_write_failed();
 }
 
-void lcd_clear_block(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
+/* Returns 1 if it did not make it to the display. */
+static uint8_t lcd_fill(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
 {
+	lcd_flush();
+	lcd_shadow_inval(x, y, w, h);
 	ssd1306_setbox(x, y, w, h);
 	uint16_t total = (uint16_t)w*(uint16_t)h;
-	if (ssd1306_start()) return;
+	if (ssd1306_start()) goto fail;
 	do {
-		if (ssd1306_data(0)) return;
+		if (ssd1306_data(0)) goto fail;
 	} while (--total);
 	ssd1306_end();
+	return 0;
+fail:
+	lcd_write_failed();
+	return 1;
 }
 
+void lcd_clear_block(uint8_t x, uint8_t y, uint8_t w, uint8_t h)
+{
+	lcd_fill(x, y, w, h);
+}
 
-// mfont8x8.c is generated with https://github.com/urjaman/st7565-fontgen
-#include "mfont8x8.c"
+
+// mfont2x.c is generated by host/fontgen2x.c from mfont8x8.c,
+// which is generated with https://github.com/urjaman/st7565-fontgen
+#include "mfont2x.c"
 
 // Some data for dynamic width mode with this font.
 #include "font-dyn-meta.c"
 
 
-uint8_t lcd_fontdata(uint8_t *buf, unsigned char c, uint8_t dw)
+static void lcd_putchar_(unsigned char c, uint8_t dw)
 {
-	PGM_P block;
 	if (c < 0x20) c = 0x20;
-	block = (const char*)&(mfont[c-0x20][0]);
+	const uint8_t *hi = mfont2x[c-0x20][0];
 	uint8_t w = LCD_CHARW;
 	if (dw) {
 		uint8_t font_meta_b = pgm_read_byte(&(font_metadata[c-0x20]));
-		block += XOFF(font_meta_b);
+		hi += XOFF(font_meta_b);
 		w = DW(font_meta_b);
 	}
-	memcpy_P(buf, block, w);
-	return w;
-}
-
-static void lcd_putchar_(unsigned char c, uint8_t dw)
-{
-	uint8_t buf[LCD_CHARW];
-	uint8_t w = lcd_fontdata(buf, c, dw);
-	lcd_font2x(buf, w);
+	const uint8_t *lo = hi + LCD_CHARW;
+	do {
+		lcd_pend_col(pgm_read_byte(hi++), pgm_read_byte(lo++));
+	} while (--w);
 }
 
 void lcd_putchar(unsigned char c)
@@ -206,19 +365,15 @@ uint8_t lcd_puts_dw_P(PGM_P str)
 }
 
 void lcd_clear_dw(uint8_t w) {
-	int8_t h = lf_height;
 	if (!w) return;
 	if ((lcd_char_x+w)>LCDWIDTH) {
 		w = LCDWIDTH - lcd_char_x;
 		if (!w) return;
 	}
-
-	if ((lcd_char_y+h)>LCD_MAXY) {
-		h = LCD_MAXY - lcd_char_y;
-		if (h <= 0) return;
-	}
-	lcd_clear_block(lcd_char_x, lcd_char_y, w, h);
-	lcd_char_x += w;
+	if (lcd_char_y >= LCD_MAXY) return;
+	do {
+		lcd_pend_col(0, 0);
+	} while (--w);
 }
 
 void lcd_clear_eol(void) {
@@ -276,15 +431,28 @@ void lcd_gotoxy(uint8_t x, uint8_t y)
 
 void lcd_clear(void)
 {
-	lcd_clear_block(0,0, LCDWIDTH, LCD_MAXY);
+	lcd_pend_x = 0xFF;
+	if (!lcd_fill(0,0, LCDWIDTH, LCD_MAXY)) lcd_shadow_blank();
 	lcd_char_x = 0;
 	lcd_char_y = 0;
 }
 
-void lcd_init(void)
+/* The display may have been power cycled, so it gets set up (the contrast and flip
+ * come along with ssd1306_init) and cleared like at boot, except that an idle off
+ * display stays off. Whatever was on it is for the TUI to redraw. */
+void lcd_resync(void)
 {
+	lcd_flush();
 	ssd1306_init();
 	lcd_clear();
-	ssd1306_command(SSD1306_DISPLAYON);
-	disp_on = 1;
+	if (disp_state != LCD_OFF) ssd1306_command(SSD1306_DISPLAYON);
+	lcd_damage = 1;
+}
+
+void lcd_init(void)
+{
+	disp_state = LCD_ON;
+	ssd1306_contrast(SSD1306_DEF_CONTRAST);
+	lcd_resync();
+	lcd_damage = 0;
 }
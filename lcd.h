@@ -34,5 +34,17 @@ void lcd_clear_dw(uint8_t w);
 void lcd_write_dwb(uint8_t *buf, uint8_t w);
 void lcd_clear_eol(void);
 
-/* Crude on/off control to preserve OLED life ... */
-void lcd_idle(uint8_t idle);
+/* Sends out the pending partially written cell, the main loop does this. */
+void lcd_flush(void);
+
+/* On/dim/off control to preserve OLED life (and power) ... */
+#define LCD_ON 0
+#define LCD_DIM 1
+#define LCD_OFF 2
+void lcd_idle(uint8_t state);
+uint8_t lcd_is_on(void);
+uint8_t lcd_get_changes(void);
+/* Set up a display that was lost and found again, see ssd1306_run. */
+void lcd_resync(void);
+/* Something failed to reach the display since the last call, it needs a full redraw. */
+uint8_t lcd_get_damage(void);
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include "main.h"
+#include "sensor.h"
+#include "lm75.h"
+#include "i2c.h"
+#include "swi2c.h"
+
+/* LM75 (and compatibles), it converts continuously so there's nothing to start
+ * but the read. On the TWI that is queued to the ISR like the RTC read and poll
+ * waits for it; sensor_run only runs one driver at a time, so one transfer will do. */
+
+static const uint8_t lm75_reg0 = 0;
+static uint8_t lm75_buf[2];
+static struct i2c_xfer lm75_x = {
+	.wbuf = &lm75_reg0,
+	.wlen = 1,
+	.rbuf = lm75_buf,
+	.rlen = sizeof(lm75_buf),
+};
+
+static uint16_t lm75_start(uint8_t arg)
+{
+	uint8_t addr = arg & 0xFE;
+	if (arg & LM75_SWI2C) {
+		/* Bit-banged, so this one holds the CPU; sensor_run comes after lcd_flush has
+		 * ended any OLED transaction. The pointer is at the temperature since power up,
+		 * so a plain 2 byte read keeps the bus time short. */
+		lm75_x.status = swi2c_read(addr, 2, lm75_buf) ? I2C_X_NAK : I2C_X_OK;
+		return 0;
+	}
+	lm75_x.addr = addr;
+	if (i2c_submit(&lm75_x)) lm75_x.status = I2C_X_ERR;
+	return 1;
+}
+
+static uint16_t lm75_poll(uint8_t arg)
+{
+	(void)arg;
+	return (lm75_x.status & I2C_X_PENDING) ? 1 : 0;
+}
+
+static uint8_t lm75_read(uint8_t arg, int16_t *v)
+{
+	(void)arg;
+	if (lm75_x.status != I2C_X_OK) return SENSOR_E_NORESP;
+	int16_t t = (int16_t)((lm75_buf[0] << 8) | lm75_buf[1]) >> 7; /* 0.5 C */
+	v[0] = t * 5;
+	return SENSOR_OK;
+}
+
+static const char lm75_u0[] PROGMEM = "T[C]";
+
+const struct sensor_ops lm75_ops PROGMEM = {
+	.init = NULL,
+	.start = lm75_start,
+	.poll = lm75_poll,
+	.read = lm75_read,
+	.units = { lm75_u0, NULL },
+	.nvals = 1,
+	.scale = 1,
+	.interval = 1,
+	.vmin = { -550, 0 },
+	.vmax = { 1250, 0 },
+	.vdelta = { 50, 0 },
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include "sensor.h"
+
+/* Or this into the address to use the software I2C bus (shared with the OLED). */
+#define LM75_SWI2C 1
+
+extern const struct sensor_ops lm75_ops;
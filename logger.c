@@ -4,51 +4,103 @@
 #include "fat.h"
 #include "partition.h"
 #include "sd_raw.h"
-#include "ams2302.h"
+#include "sensor.h"
+#include "prof.h"
+#include "config.h"
 #include <stdio.h>
 
 
-#define LOGBUF_FLUSH 256
-#define LOGGER_INTERVAL 300
-
 static char logbuf[LOGBUF_SZ];
 static uint16_t logbuf_woff = 0;
+/* Linear time of the first line in logbuf, for the index; 0 if it was not valid. */
+static uint32_t logbuf_t0;
+
+/* Per sensor: "," + value per value and ",Q" */
+#define LOG_SENSOR_LEN (SENSOR_MAXVALS*8 + 2)
+
+/* The most a line can take, with the sensors there are. */
+static uint16_t logger_line_max(void) {
+	return 37 + sensor_count()*LOG_SENSOR_LEN;
+}
 
 static void logger_line(void) {
-	int16_t t10;
-	uint16_t rh10;
-	uint8_t ts[8], rhs[8];
-	const int log_len = 56;
 	struct mtm tm;
-	if (logbuf_woff >= (LOGBUF_SZ-log_len)) return;
+	uint8_t sc = sensor_count();
+	if ((logbuf_woff + logger_line_max()) >= LOGBUF_SZ) return;
 	timer_get_time(&tm);
-	ts[0] = 0;
-	rhs[0] = 0;
-	if (!ams_get(&t10, &rh10, LOGGER_INTERVAL/2)) {
-		make_v10_str(ts, t10);
-		make_v10_str(rhs, rh10);
-	}
+	if (!logbuf_woff) logbuf_t0 = timer_time_isvalid() ? mtm2linear(&tm) : 0;
 	logbuf_woff += sprintf_P(logbuf + logbuf_woff,
-	     /*  4     3    3    3    3    3   3  11 1 */
-		PSTR("%04u-%02u-%02u %02u:%02u:%02u,%c,%010lu,%s,%s\n"),
+	     /*  4     3    3    3    3    3   3  11 */
+		PSTR("%04u-%02u-%02u %02u:%02u:%02u,%c,%010lu"),
 		tm.year + TIME_EPOCH_YEAR, tm.month, tm.day,
 		tm.hour, tm.min, tm.sec, timer_time_isvalid() ? '*' : '?',
-		timer_get(), ts, rhs
+		timer_get()
 	);
+	char *wp = logbuf + logbuf_woff;
+	for (uint8_t i=0; i < sc; i++) {
+		int16_t v[SENSOR_MAXVALS];
+		uint8_t n = sensor_nvals(i);
+		PGM_P r = sensor_get(i, v, cfg.log_interval > 510 ? 255 : cfg.log_interval/2);
+		for (uint8_t vi=0; vi < n; vi++) {
+			*wp++ = ',';
+			if (!r) {
+				sensor_val_str((unsigned char*)wp, v[vi], sensor_scale(i));
+				wp += strlen(wp);
+			}
+		}
+		*wp++ = ',';
+		*wp++ = r ? SENSOR_Q_NONE : sensor_quality(i);
+	}
+	*wp++ = '\n';
+	logbuf_woff = wp - logbuf;
 }
 
+/* Describes the columns, written on every mount as the sensor set can change between firmwares. */
+static void logger_header(struct fat_file_struct *fp) {
+	char hb[24];
+	uint8_t l = sprintf_P(hb, PSTR("#date time,valid,uptime"));
+	fat_write_file(fp, (uint8_t*)hb, l);
+	for (uint8_t i=0; i < sensor_count(); i++) {
+		uint8_t n = sensor_nvals(i);
+		for (uint8_t vi=0; vi < n; vi++) {
+			l = sprintf_P(hb, PSTR(",%u:%S"), i, sensor_units(i, vi));
+			fat_write_file(fp, (uint8_t*)hb, l);
+		}
+		l = sprintf_P(hb, PSTR(",%u:Q"), i);
+		fat_write_file(fp, (uint8_t*)hb, l);
+	}
+	fat_write_file(fp, (uint8_t*)"\n", 1);
+}
+
+/* The .IDX file next to the log (DATALOG.IDX for DATALOG.TXT) is a sparse time index
+ * into it: every flush that starts with a line with a valid time appends the time
+ * (linear) and the file offset of that line, as two little-endian uint32_t's.
+ * Appending only when the clock is valid keeps it in order unless the clock is set
+ * backwards. Each log name gets its own index, so offsets never point into another file. */
+#define LOGIDX_REC 8
+
 static uint32_t next_log;
 
 static PGM_P fat_err;
 static int8_t sd_stat = 0;
+static uint8_t sd_gen;
 static struct partition_struct sd_part;
 static struct fat_fs_struct sd_fat;
 static struct fat_file_struct log_file;
+/* The index of the log that is mounted. cfg.log_name can change before the eject
+ * flushes the old log, so the index records go by this instead. */
+static char log_idx[sizeof(cfg.log_name)];
+
+/* The log name with the extension replaced by IDX, fn is sizeof(cfg.log_name). */
+static void logger_idx_name(char *fn) {
+	strcpy(fn, cfg.log_name);
+	char *dot = strchr(fn, '.');
+	if (!dot) dot = fn + strlen(fn);
+	strcpy_P(dot, PSTR(".IDX"));
+}
 
 static void logger_sd_init(void) {
-	PGM_P fn_P = PSTR("DATALOG.TXT");
-	char fn[12];
-	strcpy_P(fn, fn_P);
+	char fn[sizeof(cfg.log_name)];
 	if (sd_stat != 0) return;
 	if (!sd_raw_init()) return;
         struct partition_struct* partition = 
@@ -85,6 +137,9 @@ static void logger_sd_init(void) {
 		goto err_fat;
 	}
 	struct fat_dir_entry_struct file_de;
+	logger_idx_name(log_idx);
+	fat_create_file(dd, log_idx, &file_de);
+	strcpy(fn, cfg.log_name);
 	uint8_t r = fat_create_file(dd, fn, &file_de);
 	fat_close_dir(dd);
 	if (r == 0) {
@@ -102,8 +157,10 @@ static void logger_sd_init(void) {
 		fat_close_file(fp);
 		goto err_fat;
 	}
+	logger_header(fp);
 	fat_err = NULL;
 	sd_stat = 1;
+	sd_gen++;
 	return;
 	
 err_fat:
@@ -119,20 +176,45 @@ static void logger_sd_detach(void) {
 	partition_close(&sd_part);
 	sd_raw_sync();
 	sd_stat = 0;
+	sd_gen++;
+}
+
+static uint8_t logger_open_idx(struct fat_file_struct *fd) {
+	struct fat_dir_entry_struct de;
+	if (!fat_get_dir_entry_of_path(&sd_fat, log_idx, &de)) return 1;
+	if (!fat_open_file(&sd_fat, &de, fd)) return 1;
+	return 0;
+}
+
+/* A lost index record only makes queries start earlier, so errors are ignored here. */
+static void logger_index(uint32_t off) {
+	struct fat_file_struct fd;
+	uint32_t rec[2] = { logbuf_t0, off };
+	if (!logbuf_t0) return;
+	if (logger_open_idx(&fd)) return;
+	int32_t seek = 0;
+	if (fat_seek_file(&fd, &seek, FAT_SEEK_END))
+		fat_write_file(&fd, (uint8_t*)rec, LOGIDX_REC);
+	fat_close_file(&fd);
 }
 
 static void logger_flush(void) {
 	if (sd_stat != 1) return;
 	if (!logbuf_woff) return;
+	PROF_ENTER(PROF_SDFLUSH);
+	uint32_t off = log_file.pos;
 	if (fat_write_file(&log_file, (void*)logbuf, logbuf_woff) != (int)logbuf_woff) {
 		logger_sd_detach();
-		return;
+		goto out;
 	}
+	logger_index(off);
 	if (!sd_raw_sync()) {
 		logger_sd_detach();
-		return;
+		goto out;
 	}
 	logbuf_woff = 0;
+out:
+	PROF_EXIT(PROF_SDFLUSH);
 }
 
 void logger_init(void) {
@@ -156,8 +238,9 @@ void logger_run(void) {
 					logger_sd_init();
 				}
 			}
-			next_log = now + LOGGER_INTERVAL;
-			if (logbuf_woff >= LOGBUF_FLUSH) {
+			next_log = now + cfg.log_interval;
+			/* Also when the next line would not fit, whatever LOGFLUSH is. */
+			if ((logbuf_woff >= cfg.log_flush)||((logbuf_woff + logger_line_max()) >= LOGBUF_SZ)) {
 				logger_flush();
 			}
 		}
@@ -179,6 +262,10 @@ uint8_t logger_sd_status(void) {
 	return sd_stat;
 }
 
+uint8_t logger_sd_gen(void) {
+	return sd_gen;
+}
+
 uint16_t logger_buf_stat(void) {
 	return logbuf_woff;
 }
@@ -187,6 +274,51 @@ PGM_P logger_sd_err(void) {
 	return fat_err;
 }
 
+/* A separate read handle on DATALOG.TXT, with the buffered lines flushed into it first.
+ * Returns 1 if there is no card. */
+uint8_t logger_open_log(struct fat_file_struct *fd) {
+	logger_flush();
+	if (sd_stat != 1) return 1;
+	if (!fat_open_file(&sd_fat, &log_file.dir_entry, fd)) return 1;
+	return 0;
+}
+
+/* The logger's mount, for the SD commands in sdcmd.c, with the buffered lines flushed.
+ * NULL if there is no card. Do not hold on to it (or handles on it) past the next
+ * logger_run without checking that logger_sd_gen has not changed. */
+struct fat_fs_struct *logger_get_fs(void) {
+	logger_flush();
+	if (sd_stat != 1) return NULL;
+	return &sd_fat;
+}
+
+/* Offset in DATALOG.TXT to start looking for time t from: that of the last index
+ * record before it, or 0. A binary search, so a handful of block reads. */
+uint32_t logger_index_find(uint32_t t) {
+	struct fat_file_struct fd;
+	uint32_t found = 0;
+	logger_flush();
+	if (sd_stat != 1) return 0;
+	if (logger_open_idx(&fd)) return 0;
+	uint32_t lo = 0;
+	uint32_t hi = fd.dir_entry.file_size / LOGIDX_REC;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t rec[2];
+		int32_t seek = mid * LOGIDX_REC;
+		if ((!fat_seek_file(&fd, &seek, FAT_SEEK_SET))||
+			(fat_read_file(&fd, (uint8_t*)rec, LOGIDX_REC) != LOGIDX_REC)) break;
+		if (rec[0] < t) {
+			found = rec[1];
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	fat_close_file(&fd);
+	return found;
+}
+
 uint32_t logger_log_size(void) {
 	return log_file.pos;
 }
\ No newline at end of file
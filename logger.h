@@ -5,12 +5,20 @@ void logger_run(void);
 void logger_sd_eject(uint8_t eject);
 
 uint8_t logger_sd_status(void);
+/* Changes on every mount and detach, handles from an earlier one are no good. */
+uint8_t logger_sd_gen(void);
 
 PGM_P logger_sd_err(void);
 
 uint16_t logger_buf_stat(void);
 uint32_t logger_log_size(void);
 
+struct fat_file_struct;
+uint8_t logger_open_log(struct fat_file_struct *fd);
+struct fat_fs_struct;
+struct fat_fs_struct *logger_get_fs(void);
+uint32_t logger_index_find(uint32_t t);
+
 
 #define LOGBUF_SZ 384
 
@@ -27,34 +27,83 @@
 #include "powermgmt.h"
 #include "logger.h"
 #include "rcminitx.h"
-#include "ams2302.h"
+#include "sensor.h"
+#include "prof.h"
+#include "telem.h"
+#include "config.h"
 
 void cli_bgloop(void) {
+	/* Ends the OLED transaction that drawing may have left open, before anything else uses the bus. */
+	lcd_flush();
+	PROF_ENTER(PROF_TIMER);
 	timer_run();
+	PROF_EXIT(PROF_TIMER);
 	if ((uart_isdata()) ||(getline_i) ) timer_activity();
 	ssd1306_run();
-	ams_run();
+	sensor_run();
+	telem_run();
+	PROF_ENTER(PROF_LOGGER);
 	logger_run();
+	PROF_EXIT(PROF_LOGGER);
 }
 
 void mini_mainloop(void) {
 	cli_bgloop();
+	PROF_ENTER(PROF_CIFACE);
 	ciface_run();
+	PROF_EXIT(PROF_CIFACE);
+}
+
+static uint8_t task_running;
+
+/* Input other than ^C is left for the console to read after the task. */
+uint8_t task_exec(uint8_t (*step)(void *ctx), void *ctx) {
+	uint8_t r;
+	task_running = 1;
+	while ((r = step(ctx)) != TASK_DONE) {
+		if ((uart_isdata())&&(PEEK() == TASK_CANCEL)) {
+			RECEIVE();
+			sendstr_P(PSTR("^C"));
+			break;
+		}
+		if (r == TASK_MORE) timer_set_waiting();
+		cli_bgloop();
+	}
+	task_running = 0;
+	return r != TASK_DONE;
+}
+
+uint8_t task_busy(void) {
+	return task_running;
 }
 
 void main (void) __attribute__ ((noreturn));
 
 
 void main(void) {
+	cfg_init();
 	uart_init();
 	ciface_init();
 	pm_init();
 	timer_init();
+#ifdef UART_AUTOBAUD
+	{
+		/* A 'U' from the host within a second of reset picks the console rate. */
+		uint32_t baud = 0;
+		uart_autobaud_start();
+		for (uint8_t i=0; (i < 100)&&(!baud); i++) {
+			timer_delay_ms(10);
+			baud = uart_autobaud_poll();
+		}
+		uart_autobaud_stop();
+		if (baud) uart_set_baud(baud);
+	}
+#endif
 	buttons_init();
 	swi2c_init();
-	lcd_init();
 	i2c_init();
-	ams_init();
+	lcd_init();
+	sensor_init();
 	logger_init();
 	tui_init();
 	for(;;) {
@@ -29,6 +29,16 @@
 void mini_mainloop(void);
 void cli_bgloop(void);
 
+/* Long console commands run as a task: step does a bit of the work and returns one of
+ * these, task_exec runs cli_bgloop in between so sampling, logging and the display
+ * keep their schedule. A ^C from the console cancels, task_exec then returns 1. */
+#define TASK_DONE 0
+#define TASK_MORE 1 /* call again right away */
+#define TASK_WAIT 2 /* call again after the next tick or event */
+#define TASK_CANCEL 0x03
+uint8_t task_exec(uint8_t (*step)(void *ctx), void *ctx);
+uint8_t task_busy(void);
+
 /* Enable 24-bit types as an optimization for gcc 4.7+ */
 #if (((__GNUC__ == 4)&&(__GNUC_MINOR__ >= 7)) || (__GNUC__ > 4))
 typedef __int24 int24_t;
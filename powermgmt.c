@@ -6,6 +6,8 @@
 #include "i2c.h"
 #include "rtc.h"
 #include "powermgmt.h"
+#include "sensor.h"
+#include "uart.h"
 #include "tui-lib.h"
 #include <avr/wdt.h>
 
@@ -35,6 +37,7 @@ void tui_poweroff(void) {
 	if (!tui_are_you_sure()) return;
 	lcd_clear();
 	lcd_puts_P(PSTR("POWER OFF IN 1s!"));
+	lcd_flush();
 	for(uint8_t i=0;i<10;i++) timer_delay_ms(100);
 	if (rtc_read(&rtc_before)) rtc_fail = 1;
 	do_poweroff();
@@ -79,6 +82,9 @@ void low_power_mode(void) {
 	cli();
 	/* Uhh, if we are not idle, use the "idle" sleep mode instead of power-down. */
 	if (!timer_get_idle()) goto idle;
+	if (sensor_busy()) goto idle;
+	if (i2c_busy()) goto idle;
+	if (uart_autobaud_busy()) goto idle;
 	SMCR = _BV(SM1) | _BV(SE); /* sleep enable and set mode */
 	EIMSK = 3;
 	WDTCSR |= _BV(WDIE); /* Enable WDT for timing. */
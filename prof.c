@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Only built with PROFILE=1, see the Makefile. */
+
+#include "main.h"
+#include "timer.h"
+#include "prof.h"
+#include "uart.h"
+#include "console.h"
+#include "lib.h"
+#include "ciface.h"
+
+#define CYC_PER_US (F_CPU/1000000UL)
+#define PROF_RING 16
+
+struct prof_stat {
+	uint32_t total_us; /* wraps after ~71 minutes, PROF CLR it */
+	uint16_t max_us;
+	uint16_t calls;
+};
+
+struct prof_ev {
+	uint8_t ev; /* region+1 (0 = unused slot), bit 7 set = exit */
+	uint16_t t_us; /* low 16 bits of the timestamp */
+};
+
+static struct prof_stat prof_stats[PROF_REGIONS];
+static uint32_t prof_start[PROF_REGIONS];
+static uint8_t prof_open;
+static struct prof_ev prof_ring[PROF_RING];
+static uint8_t prof_ring_w;
+
+/* CPU cycles, monotonic (in the main context) since it includes the seconds counter.
+ * Wraps every 2^32 cycles, which is fine for region lengths. */
+static uint32_t prof_now(void)
+{
+	uint24_t s1, s2;
+	uint8_t cnt;
+	do {
+		s1 = timer_get_linear_ss_time();
+		cnt = TCNT0;
+		s2 = timer_get_linear_ss_time();
+	} while (s1 != s2);
+	uint32_t ss = timer_get() * SSTC + s1;
+	return (ss << 8) | cnt;
+}
+
+static void prof_log(uint8_t ev, uint32_t now)
+{
+	uint8_t w = prof_ring_w;
+	prof_ring[w].ev = ev;
+	prof_ring[w].t_us = now / CYC_PER_US;
+	prof_ring_w = (w+1) & (PROF_RING-1);
+}
+
+void prof_enter(uint8_t r)
+{
+	if (prof_open & _BV(r)) return; /* Only the outermost one is timed. */
+	prof_open |= _BV(r);
+	uint32_t now = prof_now();
+	prof_log(r+1, now);
+	prof_start[r] = now;
+}
+
+void prof_exit(uint8_t r)
+{
+	uint32_t now = prof_now();
+	if (!(prof_open & _BV(r))) return;
+	prof_open &= ~_BV(r);
+	prof_log((r+1) | 0x80, now);
+	uint32_t us = (now - prof_start[r]) / CYC_PER_US;
+	struct prof_stat *s = &(prof_stats[r]);
+	s->total_us += us;
+	if (us > 0xFFFF) us = 0xFFFF;
+	if (us > s->max_us) s->max_us = us;
+	s->calls++;
+}
+
+static const unsigned char prof_n0[] PROGMEM = "TIMER";
+static const unsigned char prof_n1[] PROGMEM = "CIFACE";
+static const unsigned char prof_n2[] PROGMEM = "OLED";
+static const unsigned char prof_n3[] PROGMEM = "SENSOR";
+static const unsigned char prof_n4[] PROGMEM = "LOGGER";
+static const unsigned char prof_n5[] PROGMEM = "SDFLUSH";
+static const unsigned char prof_n6[] PROGMEM = "IDLE";
+
+static PGM_P const prof_names[PROF_REGIONS] PROGMEM = {
+	(PGM_P)prof_n0,
+	(PGM_P)prof_n1,
+	(PGM_P)prof_n2,
+	(PGM_P)prof_n3,
+	(PGM_P)prof_n4,
+	(PGM_P)prof_n5,
+	(PGM_P)prof_n6,
+};
+
+static void prof_sendnum(uint32_t v)
+{
+	unsigned char buf[12];
+	buf[0] = ' ';
+	luint2str(buf+1, v);
+	sendstr(buf);
+}
+
+static void prof_report(void)
+{
+	sendstr_P(PSTR("REGION CALLS TOTAL_US MAX_US"));
+	for (uint8_t r=0; r < PROF_REGIONS; r++) {
+		struct prof_stat s = prof_stats[r];
+		sendstr_P(PSTR("\r\n"));
+		sendstr_P((PGM_P)pgm_read_word(&(prof_names[r])));
+		prof_sendnum(s.calls);
+		prof_sendnum(s.total_us);
+		prof_sendnum(s.max_us);
+	}
+}
+
+static void prof_dump_ring(void)
+{
+	uint8_t i = prof_ring_w;
+	do {
+		struct prof_ev e = prof_ring[i];
+		i = (i+1) & (PROF_RING-1);
+		uint8_t r = e.ev & 0x7F;
+		if (!r) continue;
+		r--;
+		sendstr_P((PGM_P)pgm_read_word(&(prof_names[r])));
+		sendstr_P(e.ev & 0x80 ? PSTR(" X") : PSTR(" E"));
+		prof_sendnum(e.t_us);
+		sendstr_P(PSTR("\r\n"));
+	} while (i != prof_ring_w);
+}
+
+CIFACE_APP(prof_cmd, "PROF")
+{
+	if (token_count >= 2) {
+		if (strcmp_P((char*)tokenptrs[1], PSTR("CLR")) == 0) {
+			memset(prof_stats, 0, sizeof(prof_stats));
+			memset(prof_ring, 0, sizeof(prof_ring));
+			return;
+		}
+		if (strcmp_P((char*)tokenptrs[1], PSTR("LOG")) == 0) {
+			prof_dump_ring();
+			return;
+		}
+	}
+	prof_report();
+}
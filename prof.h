@@ -0,0 +1,23 @@
+#pragma once
+
+/* Main loop profiler. Build with "make PROFILE=1" to get it, otherwise
+ * the PROF_* macros compile to nothing and prof.c is not even built. */
+
+#define PROF_TIMER 0
+#define PROF_CIFACE 1
+#define PROF_OLED 2
+#define PROF_SENSOR 3
+#define PROF_LOGGER 4
+#define PROF_SDFLUSH 5
+#define PROF_IDLE 6 /* the sleep in timer_run, left out of PROF_TIMER */
+#define PROF_REGIONS 7
+
+#ifdef PROFILER
+void prof_enter(uint8_t r);
+void prof_exit(uint8_t r);
+#define PROF_ENTER(r) prof_enter(r)
+#define PROF_EXIT(r) prof_exit(r)
+#else
+#define PROF_ENTER(r) do { } while(0)
+#define PROF_EXIT(r) do { } while(0)
+#endif
@@ -18,10 +18,20 @@ static uint8_t writebcd(uint8_t bin) {
 
 static uint8_t rtc_is_ok=0;
 
-// 0 = OK, nonzero = not ok
-uint8_t rtc_read(struct mtm* tm) {
-	uint8_t buf[10];
-	if (i2c_read_regs(RTC_I2C_ADDR,0,10,buf)) {
+static const uint8_t rtc_reg0 = 0;
+static uint8_t rtc_buf[10];
+static struct i2c_xfer rtc_x = {
+	.addr = RTC_I2C_ADDR,
+	.wbuf = &rtc_reg0,
+	.wlen = 1,
+	.rbuf = rtc_buf,
+	.rlen = sizeof(rtc_buf),
+};
+static uint8_t rtc_pending;
+
+static uint8_t rtc_parse(struct mtm* tm) {
+	uint8_t *buf = rtc_buf;
+	if (rtc_x.status != I2C_X_OK) {
 		rtc_is_ok=0;
 		return 1; // Not OK
 	}
@@ -31,7 +41,7 @@ uint8_t rtc_read(struct mtm* tm) {
 	}
 	tm->sec = readbcd(buf[0]);
 	tm->min = readbcd(buf[1]&0x7F);
-	tm->hour = readbcd(buf[2]&0x3F);	
+	tm->hour = readbcd(buf[2]&0x3F);
 	tm->year = readbcd(buf[6]);
 	tm->month = readbcd(buf[5]&0x1F);
 	tm->day = readbcd(buf[4]&0x3F);
@@ -46,6 +56,32 @@ uint8_t rtc_read(struct mtm* tm) {
 	return 0; // OK
 }
 
+/* Start a read in the background, rtc_read_done gives the result. */
+void rtc_read_start(void) {
+	if (rtc_pending) return;
+	if (i2c_submit(&rtc_x)) return;
+	rtc_pending = 1;
+}
+
+/* Result of rtc_read_start like rtc_read, or RTC_BUSY if it's not done (or was not started). */
+uint8_t rtc_read_done(struct mtm* tm) {
+	if ((!rtc_pending) || (rtc_x.status & I2C_X_PENDING)) return RTC_BUSY;
+	rtc_pending = 0;
+	return rtc_parse(tm);
+}
+
+// 0 = OK, nonzero = not ok
+uint8_t rtc_read(struct mtm* tm) {
+	uint8_t rv;
+	rtc_read_start();
+	if (!rtc_pending) {
+		rtc_is_ok = 0;
+		return 1;
+	}
+	while ((rv = rtc_read_done(tm)) == RTC_BUSY) sleep_mode();
+	return rv;
+}
+
 
 void rtc_write(struct mtm* tm) {
 	uint8_t buf[10];
@@ -59,6 +95,10 @@ void rtc_write(struct mtm* tm) {
 	buf[7] = 0; /* Controls, dont use SQWO or OUT */
 	buf[8] = tm->year/100;
 	buf[9] = (tm->year/100) ^ 0xFF; // a bit of a checksum so the century doesnt get used accidentally
+	if (rtc_pending) { // Whatever it read is stale now.
+		i2c_wait(&rtc_x);
+		rtc_pending = 0;
+	}
 	if (i2c_write_regs(RTC_I2C_ADDR,0,10,buf)) {
 		rtc_is_ok = 0;
 		return; // Not OK
@@ -1,5 +1,9 @@
 #pragma once
 
+#define RTC_BUSY 0xFF
+
 uint8_t rtc_read(struct mtm* tm);
+void rtc_read_start(void);
+uint8_t rtc_read_done(struct mtm* tm);
 void rtc_write(struct mtm* tm);
 uint8_t rtc_valid(void);
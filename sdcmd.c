@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* SD card commands on the logger's mount (logger_get_fs), so they do not need the
+ * card to themselves and see the log as written so far:
+ *	LS [path]			directory listing, "/" by default
+ *	STAT path			size, date and attributes of one entry
+ *	READ path offset length [RAW]	hex dump (or the raw bytes) of a range
+ *	TAIL [bytes]			the end of DATALOG.TXT, 512 bytes by default
+ *	QUERY from to			the log lines with a valid time from..to (inclusive),
+ *					as YYYY-MM-DD[Thh:mm[:ss]], a date alone for "to" is
+ *					the whole day; seeks there with the log's .IDX
+ * Paths are as LS shows them, from the root. The longer ones run as tasks a block
+ * at a time with the main loop going in between, ^C stops them. */
+
+#include "main.h"
+#include "uart.h"
+#include "console.h"
+#include "lib.h"
+#include "ciface.h"
+#include "logger.h"
+#include "fat.h"
+#include "time.h"
+#include <stdio.h>
+
+#define SD_TAIL_DEFAULT 512
+#define SD_BLOCK 16
+
+/* Log lines start "YYYY-MM-DD hh:mm:ss,V," with V '*' when the time is valid. */
+#define SD_LINE_HEAD 21
+
+/* A file sent from off to end by sd_stream_step, out gets each block
+ * (at off) and returns 1 to stop early. */
+struct sd_stream {
+	struct fat_file_struct fd;
+	uint32_t off, end;
+	uint8_t (*out)(struct sd_stream *s, const uint8_t *b, uint8_t n);
+	uint8_t gen; /* logger_sd_gen when opened */
+	uint8_t raw; /* READ */
+	uint8_t skip; /* TAIL, until the first line boundary */
+	/* QUERY */
+	uint8_t hn, print;
+	char head[SD_LINE_HEAD];
+	uint32_t from, to, lines;
+};
+
+static struct fat_fs_struct *sd_get_fs(void)
+{
+	struct fat_fs_struct *fs = logger_get_fs();
+	if (!fs) sendstr_P(PSTR("ERR NO CARD"));
+	return fs;
+}
+
+/* The logger lets go of the card when it stops answering and may mount it (or
+ * another one) again in the same logger_run, either way the handles are stale. */
+static uint8_t sd_lost(uint8_t gen)
+{
+	if ((logger_sd_status() == 1)&&(logger_sd_gen() == gen)) return 0;
+	sendstr_P(PSTR("\r\nERR NO CARD"));
+	return 1;
+}
+
+static uint8_t sd_lookup(struct fat_fs_struct *fs, const unsigned char *path, struct fat_dir_entry_struct *de)
+{
+	if (!fat_get_dir_entry_of_path(fs, (const char*)path, de)) {
+		sendstr_P(PSTR("ERR NOT FOUND"));
+		return 1;
+	}
+	return 0;
+}
+
+static uint32_t sd_arg(uint8_t n, uint32_t def)
+{
+	if (token_count <= n) return def;
+	return strtoul((char*)tokenptrs[n], NULL, 10);
+}
+
+/* "name/  size  YYYY-MM-DD hh:mm:ss" */
+static void sd_entry(const struct fat_dir_entry_struct *de)
+{
+	char buf[48];
+	uint16_t y;
+	uint8_t mo, d, h, mi, s;
+	fat_get_file_modification_date(de, &y, &mo, &d);
+	fat_get_file_modification_time(de, &h, &mi, &s);
+	sprintf_P(buf, PSTR("%-12s%c %10lu  %04u-%02u-%02u %02u:%02u:%02u\r\n"),
+		de->long_name, de->attributes & FAT_ATTRIB_DIR ? '/' : ' ',
+		de->file_size, y, mo, d, h, mi, s);
+	sendstr((unsigned char*)buf);
+}
+
+static uint8_t sd_stream_step(void *ctx)
+{
+	struct sd_stream *s = ctx;
+	uint8_t b[SD_BLOCK];
+	if (s->off >= s->end) return TASK_DONE;
+	if (sd_lost(s->gen)) return TASK_DONE;
+	uint8_t n = (s->end - s->off) > SD_BLOCK ? SD_BLOCK : s->end - s->off;
+	if (fat_read_file(&s->fd, b, n) != n) {
+		sendstr_P(PSTR("\r\nERR READ"));
+		return TASK_DONE;
+	}
+	if (s->out(s, b, n)) return TASK_DONE;
+	s->off += n;
+	return TASK_MORE;
+}
+
+/* Opens the file at off, s->end is the file size. */
+static uint8_t sd_stream_open(struct sd_stream *s, struct fat_fs_struct *fs,
+	const struct fat_dir_entry_struct *de, uint32_t off)
+{
+	if ((de->attributes & FAT_ATTRIB_DIR)||(!fat_open_file(fs, de, &s->fd))) {
+		sendstr_P(PSTR("ERR OPEN"));
+		return 1;
+	}
+	s->gen = logger_sd_gen();
+	s->off = off;
+	s->end = s->fd.dir_entry.file_size;
+	int32_t seek = off;
+	if ((off > s->end)||(!fat_seek_file(&s->fd, &seek, FAT_SEEK_SET))) {
+		sendstr_P(PSTR("ERR OFFSET"));
+		fat_close_file(&s->fd);
+		return 1;
+	}
+	return 0;
+}
+
+struct sd_ls {
+	struct fat_dir_struct *dd;
+	struct fat_dir_entry_struct de;
+	uint8_t gen;
+};
+
+static uint8_t sd_ls_step(void *ctx)
+{
+	struct sd_ls *l = ctx;
+	if (sd_lost(l->gen)) return TASK_DONE;
+	if (!fat_read_dir(l->dd, &l->de)) return TASK_DONE;
+	sd_entry(&l->de);
+	return TASK_MORE;
+}
+
+CIFACE_APP(ls_cmd, "LS")
+{
+	struct fat_fs_struct *fs = sd_get_fs();
+	struct fat_dir_struct dd_in;
+	struct sd_ls l;
+	if (!fs) return;
+	if (sd_lookup(fs, token_count > 1 ? tokenptrs[1] : (unsigned char*)"/", &l.de)) return;
+	if (!(l.de.attributes & FAT_ATTRIB_DIR)) {
+		sd_entry(&l.de);
+		return;
+	}
+	l.dd = fat_open_dir(fs, &l.de, &dd_in);
+	if (!l.dd) {
+		sendstr_P(PSTR("ERR OPEN"));
+		return;
+	}
+	l.gen = logger_sd_gen();
+	task_exec(sd_ls_step, &l);
+	fat_close_dir(l.dd);
+}
+
+CIFACE_APP(stat_cmd, "STAT")
+{
+	struct fat_fs_struct *fs = sd_get_fs();
+	struct fat_dir_entry_struct de;
+	if (!fs) return;
+	if (token_count < 2) {
+		sendstr_P(PSTR("STAT path"));
+		return;
+	}
+	if (sd_lookup(fs, tokenptrs[1], &de)) return;
+	sd_entry(&de);
+	sendstr_P(PSTR("ATTR "));
+	static const char attr_names[] PROGMEM = "RHSVDA";
+	for (uint8_t i=0; i < 6; i++) {
+		if (de.attributes & _BV(i)) SEND(pgm_read_byte(&(attr_names[i])));
+	}
+	sendstr_P(PSTR(" CLUSTER "));
+	luint2outdual(de.cluster);
+}
+
+/* Hex, 16 bytes a line, or as is. */
+static uint8_t sd_dump_out(struct sd_stream *s, const uint8_t *b, uint8_t n)
+{
+	char line[8+1+SD_BLOCK*3+3];
+	if (s->raw) {
+		uart_write(b, n);
+		return 0;
+	}
+	char *p = line + sprintf_P(line, PSTR("%08lX"), s->off);
+	for (uint8_t i=0; i < n; i++) p += sprintf_P(p, PSTR(" %02X"), b[i]);
+	strcpy_P(p, PSTR("\r\n"));
+	sendstr((unsigned char*)line);
+	return 0;
+}
+
+CIFACE_APP(read_cmd, "READ")
+{
+	struct fat_fs_struct *fs = sd_get_fs();
+	struct fat_dir_entry_struct de;
+	struct sd_stream s;
+	if (!fs) return;
+	if (token_count < 4) {
+		sendstr_P(PSTR("READ path offset length [RAW]"));
+		return;
+	}
+	if (sd_lookup(fs, tokenptrs[1], &de)) return;
+	if (sd_stream_open(&s, fs, &de, sd_arg(2, 0))) return;
+	uint32_t len = sd_arg(3, 0);
+	if (len < s.end - s.off) s.end = s.off + len;
+	s.raw = (token_count > 4)&&(!strcmp_P((char*)tokenptrs[4], PSTR("RAW")));
+	s.out = sd_dump_out;
+	task_exec(sd_stream_step, &s);
+	fat_close_file(&s.fd);
+}
+
+/* The log is plain text, so this is sent as is with the newlines made CRLF. */
+static uint8_t sd_tail_out(struct sd_stream *s, const uint8_t *b, uint8_t n)
+{
+	for (uint8_t i=0; i < n; i++) {
+		if (s->skip) {
+			if (b[i] == '\n') s->skip = 0;
+			continue;
+		}
+		if (b[i] == '\n') SEND('\r');
+		SEND(b[i]);
+	}
+	return 0;
+}
+
+CIFACE_APP(tail_cmd, "TAIL")
+{
+	struct sd_stream s;
+	if (logger_open_log(&s.fd)) {
+		sendstr_P(PSTR("ERR NO LOG"));
+		return;
+	}
+	uint32_t len = sd_arg(1, SD_TAIL_DEFAULT);
+	s.gen = logger_sd_gen();
+	s.end = s.fd.dir_entry.file_size;
+	s.off = len < s.end ? s.end - len : 0;
+	int32_t seek = s.off;
+	if (!fat_seek_file(&s.fd, &seek, FAT_SEEK_SET)) {
+		sendstr_P(PSTR("ERR OFFSET"));
+		goto out;
+	}
+	/* Start at a line boundary. */
+	s.skip = !!s.off;
+	s.out = sd_tail_out;
+	task_exec(sd_stream_step, &s);
+out:
+	fat_close_file(&s.fd);
+}
+
+static uint8_t sd_digits(const char *s, uint8_t n, uint16_t *v)
+{
+	*v = 0;
+	for (uint8_t i=0; i < n; i++) {
+		if ((s[i] < '0')||(s[i] > '9')) return 1;
+		*v = *v * 10 + s[i] - '0';
+	}
+	return 0;
+}
+
+/* "YYYY-MM-DD" and then optionally sep "hh:mm" and ":ss", as in the log lines.
+ * Returns the characters used, 0 if it does not parse. */
+static uint8_t sd_parse_time(const char *s, char sep, uint32_t *t)
+{
+	struct mtm tm;
+	uint16_t y, v[5] = { 1, 1, 0, 0, 0 };
+	uint8_t n = 10;
+	if ((sd_digits(s, 4, &y))||(s[4] != '-')||(sd_digits(s+5, 2, &v[0]))||
+		(s[7] != '-')||(sd_digits(s+8, 2, &v[1]))) return 0;
+	if (s[10] == sep) {
+		if ((sd_digits(s+11, 2, &v[2]))||(s[13] != ':')||(sd_digits(s+14, 2, &v[3]))) return 0;
+		n = 16;
+		if (s[16] == ':') {
+			if (sd_digits(s+17, 2, &v[4])) return 0;
+			n = 19;
+		}
+	}
+	if ((y < TIME_EPOCH_YEAR)||(y > TIME_EPOCH_YEAR + 255)||(!v[0])||(v[0] > 12)||
+		(!v[1])||(v[1] > 31)||(v[2] > 23)||(v[3] > 59)||(v[4] > 59)) return 0;
+	tm.year = y - TIME_EPOCH_YEAR;
+	tm.month = v[0];
+	tm.day = v[1];
+	tm.hour = v[2];
+	tm.min = v[3];
+	tm.sec = v[4];
+	*t = mtm2linear(&tm);
+	return n;
+}
+
+static uint8_t sd_query_out(struct sd_stream *s, const uint8_t *b, uint8_t n)
+{
+	for (uint8_t i=0; i < n; i++) {
+		char c = b[i];
+		if (c == '\n') {
+			if (s->print) sendstr_P(PSTR("\r\n"));
+			s->hn = 0;
+			s->print = 0;
+			continue;
+		}
+		if (s->hn < SD_LINE_HEAD) {
+			s->head[s->hn++] = c;
+			if (s->hn < SD_LINE_HEAD) continue;
+			uint32_t t;
+			if ((s->head[0] == '#')||(s->head[20] != '*')||
+				(sd_parse_time(s->head, ' ', &t) != 19)||(t < s->from)) continue;
+			/* Past the range; the log is in time order unless the clock was set back. */
+			if (t > s->to) return 1;
+			s->print = 1;
+			s->lines++;
+			for (uint8_t j=0; j < SD_LINE_HEAD; j++) SEND(s->head[j]);
+			continue;
+		}
+		if (s->print) SEND(c);
+	}
+	return 0;
+}
+
+CIFACE_APP(query_cmd, "QUERY")
+{
+	struct sd_stream s;
+	uint8_t n;
+	if ((token_count < 3)||(!sd_parse_time((char*)tokenptrs[1], 'T', &s.from))||
+		(!(n = sd_parse_time((char*)tokenptrs[2], 'T', &s.to)))) {
+		sendstr_P(PSTR("QUERY YYYY-MM-DD[Thh:mm[:ss]] YYYY-MM-DD[Thh:mm[:ss]]"));
+		return;
+	}
+	if (n == 10) s.to += 86399;
+	s.off = logger_index_find(s.from);
+	if (logger_open_log(&s.fd)) {
+		sendstr_P(PSTR("ERR NO LOG"));
+		return;
+	}
+	int32_t seek = s.off;
+	if (!fat_seek_file(&s.fd, &seek, FAT_SEEK_SET)) {
+		sendstr_P(PSTR("ERR OFFSET"));
+		goto out;
+	}
+	s.gen = logger_sd_gen();
+	s.end = s.fd.dir_entry.file_size;
+	s.lines = 0;
+	s.hn = 0;
+	s.print = 0;
+	s.out = sd_query_out;
+	task_exec(sd_stream_step, &s);
+	sendstr_P(PSTR("LINES"));
+	luint2outdual(s.lines);
+out:
+	fat_close_file(&s.fd);
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include "main.h"
+#include "timer.h"
+#include "lib.h"
+#include "sensor.h"
+#include "sensor_config.h"
+#include "prof.h"
+
+/* This many failures in a row are retried at the driver interval, after that we back off
+ * exponentially up to interval << SENSOR_MAX_BACKOFF. */
+#define SENSOR_RETRIES 3
+#define SENSOR_MAX_BACKOFF 4
+/* After this many consecutive rate-of-change rejects we accept it as a real step. */
+#define SENSOR_OUTLIER_ACCEPT 3
+
+struct sensor_def {
+	const struct sensor_ops *ops;
+	uint8_t arg;
+};
+
+#define SENSOR(o, a) { &o, a },
+static const struct sensor_def sensor_table[] PROGMEM = {
+	SENSOR_TABLE
+};
+#undef SENSOR
+
+#define SENSOR_COUNT (sizeof(sensor_table)/sizeof(sensor_table[0]))
+
+struct sensor_state {
+	int16_t val[SENSOR_MAXVALS];
+	int16_t win[3][SENSOR_MAXVALS]; /* Median-of-3 window */
+	uint32_t timestamp;
+	uint32_t next_read;
+	uint8_t err;
+	uint8_t q;
+	uint8_t win_n;
+	uint8_t win_i;
+	uint8_t fails;
+	uint8_t outliers;
+	uint8_t seq; /* completed reads, for telem.c */
+	uint16_t stats[SENSOR_STATS];
+};
+
+static struct sensor_state sensor_st[SENSOR_COUNT];
+
+static const unsigned char sensor_sn0[] PROGMEM = "OK";
+static const unsigned char sensor_sn1[] PROGMEM = "No response";
+static const unsigned char sensor_sn2[] PROGMEM = "RX Failed";
+static const unsigned char sensor_sn3[] PROGMEM = "Checksum failure";
+static const unsigned char sensor_sn4[] PROGMEM = "Out of range";
+static const unsigned char sensor_sn5[] PROGMEM = "Outlier";
+
+static PGM_P const sensor_stat_names[SENSOR_STATS] PROGMEM = {
+	(PGM_P)sensor_sn0,
+	(PGM_P)sensor_sn1,
+	(PGM_P)sensor_sn2,
+	(PGM_P)sensor_sn3,
+	(PGM_P)sensor_sn4,
+	(PGM_P)sensor_sn5,
+};
+
+static void sensor_get_ops(uint8_t idx, struct sensor_ops *o, uint8_t *arg)
+{
+	const struct sensor_ops *op = (const struct sensor_ops *)pgm_read_word(&(sensor_table[idx].ops));
+	memcpy_P(o, op, sizeof(struct sensor_ops));
+	if (arg) *arg = pgm_read_byte(&(sensor_table[idx].arg));
+}
+
+static int16_t median3(int16_t a, int16_t b, int16_t c)
+{
+	if (a > b) {
+		int16_t t = a;
+		a = b;
+		b = t;
+	}
+	/* a <= b */
+	if (c <= a) return a;
+	if (c >= b) return b;
+	return c;
+}
+
+static uint8_t sensor_filter(struct sensor_state *s, const struct sensor_ops *o, const int16_t *v)
+{
+	uint8_t n = o->nvals;
+	for (uint8_t i=0; i < n; i++) {
+		if ((v[i] < o->vmin[i]) || (v[i] > o->vmax[i])) return SENSOR_E_RANGE;
+	}
+	if (s->win_n) {
+		uint8_t jump = 0;
+		for (uint8_t i=0; i < n; i++) {
+			if (abs(v[i] - s->val[i]) > o->vdelta[i]) jump = 1;
+		}
+		if (jump) {
+			if (++s->outliers < SENSOR_OUTLIER_ACCEPT) return SENSOR_E_OUTLIER;
+			/* Consistently different, so this is a real step; restart the filter. */
+			s->win_n = 0;
+			s->win_i = 0;
+		}
+	}
+	s->outliers = 0;
+	memcpy(s->win[s->win_i], v, sizeof(int16_t)*SENSOR_MAXVALS);
+	if (++s->win_i >= 3) s->win_i = 0;
+	if (s->win_n < 3) s->win_n++;
+
+	for (uint8_t i=0; i < n; i++) {
+		int16_t m;
+		if (s->win_n == 1) m = s->win[0][i];
+		else if (s->win_n == 2) m = (s->win[0][i] + s->win[1][i]) / 2;
+		else m = median3(s->win[0][i], s->win[1][i], s->win[2][i]);
+		s->val[i] = m;
+	}
+	s->q = s->win_n == 3 ? SENSOR_Q_GOOD : SENSOR_Q_PARTIAL;
+	return SENSOR_OK;
+}
+
+/* Only one acquisition runs at a time, this is its index. */
+#define SENSOR_IDLE 0xFF
+static uint8_t sensor_active = SENSOR_IDLE;
+static uint32_t sensor_deadline;
+
+/* Wake up timer_run for the short waits, the longer ones are fine with the 5hz pulse. */
+ISR(TIMER1_COMPB_vect)
+{
+	extern uint8_t timer_waiting;
+	TIMSK1 &= ~_BV(OCIE1B);
+	timer_waiting = 1;
+}
+
+static void sensor_wait_ms(uint16_t ms)
+{
+	sensor_deadline = timer_get_mono_ss() + ((uint32_t)ms * SSTC) / 1000 + 1;
+	if (ms < 30) {
+		OCR1B = TCNT1 + ms*(1000*T1_TICKS_PER_US);
+		TIFR1 = _BV(OCF1B);
+		TIMSK1 |= _BV(OCIE1B);
+	}
+}
+
+static void sensor_complete(uint8_t idx, const struct sensor_ops *o, uint8_t arg)
+{
+	int16_t v[SENSOR_MAXVALS];
+	struct sensor_state *s = &(sensor_st[idx]);
+	uint32_t now = timer_get();
+
+	uint8_t e = o->read(arg, v);
+	if (!e) e = sensor_filter(s, o, v);
+	s->stats[e]++;
+	s->err = e;
+	s->seq++;
+
+	uint8_t shift = 0;
+	if (e) {
+		if (s->fails < (SENSOR_RETRIES + SENSOR_MAX_BACKOFF)) s->fails++;
+		if (s->fails > SENSOR_RETRIES) shift = s->fails - SENSOR_RETRIES;
+	} else {
+		s->fails = 0;
+		s->timestamp = now;
+	}
+	s->next_read = now + ((uint16_t)o->interval << shift);
+	sensor_active = SENSOR_IDLE;
+}
+
+/* Start (or poll) atmost one driver per call, so nothing here waits for a sensor. */
+void sensor_run(void)
+{
+	struct sensor_ops o;
+	uint8_t arg;
+	uint16_t w;
+	uint8_t i = sensor_active;
+	if (i != SENSOR_IDLE) {
+		int32_t d = sensor_deadline - timer_get_mono_ss();
+		if (d > 0) return;
+		PROF_ENTER(PROF_SENSOR);
+		sensor_get_ops(i, &o, &arg);
+		w = o.poll(arg);
+		goto check;
+	}
+
+	uint32_t now = timer_get();
+	for (i=0; i < SENSOR_COUNT; i++) {
+		int32_t diff = sensor_st[i].next_read - now;
+		if (diff <= 0) break;
+	}
+	if (i >= SENSOR_COUNT) return;
+	PROF_ENTER(PROF_SENSOR);
+	sensor_get_ops(i, &o, &arg);
+	sensor_active = i;
+	w = o.start(arg);
+check:
+	if (w) sensor_wait_ms(w);
+	else sensor_complete(i, &o, arg);
+	PROF_EXIT(PROF_SENSOR);
+}
+
+uint8_t sensor_busy(void)
+{
+	return sensor_active != SENSOR_IDLE;
+}
+
+void sensor_init(void)
+{
+	for (uint8_t i=0; i < SENSOR_COUNT; i++) {
+		struct sensor_ops o;
+		uint8_t arg;
+		sensor_get_ops(i, &o, &arg);
+		if (o.init) o.init(arg);
+		sensor_st[i].next_read = 1;
+	}
+}
+
+uint8_t sensor_count(void)
+{
+	return SENSOR_COUNT;
+}
+
+PGM_P sensor_get(uint8_t idx, int16_t *v, uint8_t max_age)
+{
+	struct sensor_state *s = &(sensor_st[idx]);
+	uint32_t age = timer_get() - s->timestamp;
+	if ((!s->timestamp)||(age > max_age)) {
+		if (!s->timestamp) return PSTR("Too early");
+		if (s->err) return sensor_stat_name(s->err);
+		return PSTR("Too old");
+	}
+	memcpy(v, s->val, sizeof(int16_t)*SENSOR_MAXVALS);
+	return NULL;
+}
+
+uint8_t sensor_nvals(uint8_t idx)
+{
+	struct sensor_ops o;
+	sensor_get_ops(idx, &o, NULL);
+	return o.nvals;
+}
+
+uint8_t sensor_scale(uint8_t idx)
+{
+	struct sensor_ops o;
+	sensor_get_ops(idx, &o, NULL);
+	return o.scale;
+}
+
+PGM_P sensor_units(uint8_t idx, uint8_t vi)
+{
+	struct sensor_ops o;
+	sensor_get_ops(idx, &o, NULL);
+	return o.units[vi];
+}
+
+uint8_t sensor_quality(uint8_t idx)
+{
+	struct sensor_state *s = &(sensor_st[idx]);
+	if (!s->timestamp) return SENSOR_Q_NONE;
+	if (s->err) return SENSOR_Q_STALE;
+	return s->q;
+}
+
+/* Changes whenever a read completes (or fails), sensor_err tells which. */
+uint8_t sensor_seq(uint8_t idx)
+{
+	return sensor_st[idx].seq;
+}
+
+uint8_t sensor_err(uint8_t idx)
+{
+	return sensor_st[idx].err;
+}
+
+uint16_t sensor_stat(uint8_t idx, uint8_t st)
+{
+	return sensor_st[idx].stats[st];
+}
+
+PGM_P sensor_stat_name(uint8_t st)
+{
+	return (PGM_P)pgm_read_word(&(sensor_stat_names[st]));
+}
+
+void sensor_val_str(unsigned char *buf, int16_t v, uint8_t scale)
+{
+	if (scale) {
+		make_v10_str(buf, v);
+		return;
+	}
+	if (v < 0) {
+		*buf++ = '-';
+		v = -v;
+	}
+	buf[uint2str(buf, v)] = 0;
+}
+
+void make_v10_str(unsigned char*buf, int16_t t10)
+{
+	uint16_t v10;
+	if (t10 < 0) {
+		*buf++ = '-';
+		v10 = -t10;
+	} else {
+		v10 = t10;
+	}
+	uint8_t ldig = v10 % 10;
+	uint16_t pv = v10 / 10;
+	if (v10 >= 1000) {
+		*buf++ = 0x30 | (pv / 100);
+		pv = pv % 100;
+	}
+	if (v10 >= 100) {
+		*buf++ = 0x30 | (pv / 10);
+		pv = pv % 10;
+	}
+	*buf++ = 0x30 | pv;
+	*buf++ = '.';
+	*buf++ = 0x30 | ldig;
+	*buf = 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <avr/pgmspace.h>
+
+/* Sensor registry. The sensors are listed in sensor_config.h and each one
+ * is a driver (struct sensor_ops) plus an 8-bit argument for it (pin, address, channel...). */
+
+#define SENSOR_MAXVALS 2
+
+/* Driver ops, these live in PROGMEM. sensor_run calls start, then poll after the
+ * returned delay until it returns 0, and then read; none of them should block for long. */
+struct sensor_ops {
+	void (*init)(uint8_t arg); /* may be NULL */
+	/* Start an acquisition, returns the ms to wait until poll. */
+	uint16_t (*start)(uint8_t arg);
+	/* Returns 0 when done, otherwise the ms to wait until the next poll. */
+	uint16_t (*poll)(uint8_t arg);
+	/* Fetch the result into v[nvals], returns 0 or a SENSOR_E_* code. */
+	uint8_t (*read)(uint8_t arg, int16_t *v);
+	PGM_P units[SENSOR_MAXVALS]; /* e.g. "T[C]" */
+	uint8_t nvals;
+	uint8_t scale; /* decimals in the values, 0 or 1 */
+	uint8_t interval; /* minimum seconds between reads */
+	/* Plausibility limits per value */
+	int16_t vmin[SENSOR_MAXVALS];
+	int16_t vmax[SENSOR_MAXVALS];
+	int16_t vdelta[SENSOR_MAXVALS]; /* max change from the filtered value */
+};
+
+/* Pin arguments: port in bits 3-4 (B,C,D), bit number in bits 0-2. */
+#define SENSOR_PIN(port, bit) (((port)<<3)|(bit))
+#define SENSOR_PB(bit) SENSOR_PIN(0, bit)
+#define SENSOR_PC(bit) SENSOR_PIN(1, bit)
+#define SENSOR_PD(bit) SENSOR_PIN(2, bit)
+/* PINx, DDRx and PORTx are consecutive for B, C and D. */
+#define SENSOR_PINREG(p) ((&PINB) + 3*((p)>>3))
+#define SENSOR_DDRREG(p) (SENSOR_PINREG(p) + 1)
+#define SENSOR_PORTREG(p) (SENSOR_PINREG(p) + 2)
+#define SENSOR_PINMASK(p) _BV((p)&7)
+
+/* Error codes from read, also the stat counter indexes. */
+#define SENSOR_OK 0
+#define SENSOR_E_NORESP 1
+#define SENSOR_E_RXFAIL 2
+#define SENSOR_E_CSUM 3
+#define SENSOR_E_RANGE 4
+#define SENSOR_E_OUTLIER 5
+#define SENSOR_STATS 6
+
+/* Quality of the value sensor_get returns */
+#define SENSOR_Q_NONE '-'
+#define SENSOR_Q_GOOD 'G' /* median of 3 reads */
+#define SENSOR_Q_PARTIAL 'P' /* filter still filling up */
+#define SENSOR_Q_STALE 'S' /* latest read failed, this is an older value */
+
+void sensor_init(void);
+void sensor_run(void);
+/* An acquisition is in progress, so Timer1 needs to keep running. */
+uint8_t sensor_busy(void);
+
+uint8_t sensor_count(void);
+PGM_P sensor_get(uint8_t idx, int16_t *v, uint8_t max_age);
+uint8_t sensor_nvals(uint8_t idx);
+uint8_t sensor_scale(uint8_t idx);
+PGM_P sensor_units(uint8_t idx, uint8_t vi);
+uint8_t sensor_quality(uint8_t idx);
+uint8_t sensor_seq(uint8_t idx);
+uint8_t sensor_err(uint8_t idx);
+uint16_t sensor_stat(uint8_t idx, uint8_t st);
+PGM_P sensor_stat_name(uint8_t st);
+
+void sensor_val_str(unsigned char *buf, int16_t v, uint8_t scale);
+void make_v10_str(unsigned char*buf, int16_t t10);
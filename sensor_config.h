@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ams2302.h"
+#include "ds18b20.h"
+#include "lm75.h"
+#include "adcsensor.h"
+
+/* The sensors to sample and log, one SENSOR(driver_ops, argument) per sensor.
+ * Sensor 0 is the one shown on the main page (as T/RH).
+ *
+ * ams2302_ops: AMS2302/DHT22, arg = pin (SENSOR_PB(0) uses ICP1, others a pin change interrupt)
+ * ds18b20_ops: single DS18B20 on a 1-Wire pin (external pull-up, no parasite power), arg = pin
+ * lm75_ops: LM75 on I2C, arg = 8-bit address, | LM75_SWI2C for the OLED bus instead of the RTC TWI bus
+ * adc_ops: ADC input in mV against AVcc, arg = channel
+ */
+#define SENSOR_TABLE \
+	SENSOR(ams2302_ops, SENSOR_PB(0))
+
+/* For example:
+	SENSOR(ams2302_ops, SENSOR_PD(4)) \
+	SENSOR(ds18b20_ops, SENSOR_PD(5)) \
+	SENSOR(lm75_ops, 0x90) \
+	SENSOR(adc_ops, 7)
+*/
@@ -18,28 +18,39 @@
 
 // Hardware-specific support functions that MUST be customized:
 
+#ifdef SWI2C_FAST
+/* Fast-mode (400kHz): a bit is 3 delays, SCL low for two of them (tLOW >= 1.3us)
+ * and high for one (tHIGH >= 0.6us). The port accesses add a bit on top. */
+static inline void I2C_delay(void) {
+	_delay_us(0.65);
+}
+#else
 static void I2C_delay() {
 	_delay_us(2); // this should give <=50kHz ... or so.
 }
+#endif
+
+/* The build uses -fno-inline-small-functions, but a call per pin change is too slow here. */
+#define PIN_FN static inline __attribute__((always_inline))
 
-static uint8_t read_SCL(void) {
+PIN_FN uint8_t read_SCL(void) {
 	// Set SCL as input and return current level of line, 0 or 1
 	DDRC &= ~_BV(3);
 	return PINC&_BV(3);
 }
 
-static uint8_t read_SDA(void) {
+PIN_FN uint8_t read_SDA(void) {
 	// Set SDA as input and return current level of line, 0 or 1
 	DDRC &= ~_BV(2);
 	return PINC&_BV(2);
 }
 
-static void clear_SCL(void) {
+PIN_FN void clear_SCL(void) {
 	 // Actively drive SCL signal low
 	 DDRC |= _BV(3);
 }
 
-static void clear_SDA(void) {
+PIN_FN void clear_SDA(void) {
 	// Actively drive SDA signal low
 	DDRC |= _BV(2);
 }
@@ -101,7 +112,8 @@ void swi2c_stop(void){
 }
 
 // Write a bit to I2C bus
-static void i2c_write_bit(uint8_t bit) {
+static inline void i2c_write_bit(uint8_t bit) __attribute__((always_inline));
+static inline void i2c_write_bit(uint8_t bit) {
   if (bit) {
     read_SDA();
   } else {
@@ -139,12 +151,12 @@ static uint8_t i2c_is_error(void) {
 
 // Write a byte to I2C bus. Return 0 if ack by the slave.
 uint8_t swi2c_write(uint8_t byte) {
-  uint8_t bit;
   uint8_t nack;
-  for (bit = 0; bit < 8; bit++) {
-    i2c_write_bit(byte & 0x80);
-    byte <<= 1;
-  }
+  /* Unrolled, the loop overhead was a good part of a bit time in fast mode. */
+#define WBIT(n) i2c_write_bit(byte & _BV(n))
+  WBIT(7); WBIT(6); WBIT(5); WBIT(4);
+  WBIT(3); WBIT(2); WBIT(1); WBIT(0);
+#undef WBIT
   nack = i2c_read_bit();
   EDLY;
   uint8_t err = i2c_is_error() || nack;
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2019 Urja Rannikko <urjaman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Streaming telemetry: with TELEM ON the console also gets a record for every
+ * completed sensor read, pushed from the main loop so the host does not have to poll.
+ *
+ * TELEM [ON|OFF] [AGG] [LOG]	(no arguments shows the current mode)
+ *
+ * Records are single lines, NMEA style, so they are easy to pick out of the console:
+ *	$S,<uptime>,<sensor>,<err>,<quality>[,<value>...]*CC
+ *		every read; the values (scaled like the log) only when err is 0. While a
+ *		command runs only the latest read of each sensor is sent, after it
+ *	$A,<uptime>,<sensor>,<n>[,<min>,<max>,<mean>...]*CC
+ *		with AGG, every TELEM_AGG_S seconds over the good reads since the last one
+ *	$L,<uptime>,<sd status>,<buffered>,<log size>*CC
+ *		with LOG, every TELEM_LOG_S seconds
+ * CC is the XOR of the characters between $ and * in hex. */
+
+#include "main.h"
+#include "uart.h"
+#include "console.h"
+#include "lib.h"
+#include "ciface.h"
+#include "timer.h"
+#include "logger.h"
+#include "sensor.h"
+#include "sensor_config.h"
+#include "telem.h"
+
+#define SENSOR(o,a) +1
+#define TELEM_SENSORS (0 SENSOR_TABLE)
+
+#define TELEM_AGG_S 60
+#define TELEM_LOG_S 10
+
+#define TELEM_F_ON 1
+#define TELEM_F_AGG 2
+#define TELEM_F_LOG 4
+
+struct telem_agg {
+	uint16_t n;
+	int16_t min[SENSOR_MAXVALS];
+	int16_t max[SENSOR_MAXVALS];
+	int32_t sum[SENSOR_MAXVALS];
+};
+
+static uint8_t telem_mode;
+static uint8_t telem_seq[TELEM_SENSORS];
+static struct telem_agg telem_aggs[TELEM_SENSORS];
+static uint8_t telem_agg_t, telem_log_t;
+static uint8_t telem_due; /* TELEM_F_AGG/LOG records held back by a task */
+/* The latest read of each sensor until its $S is out: 0, or 1 + no values. */
+static uint8_t telem_held[TELEM_SENSORS];
+static int16_t telem_v[TELEM_SENSORS][SENSOR_MAXVALS];
+
+struct telem_line {
+	uint8_t n;
+	uint8_t sum;
+	char b[80];
+};
+
+static void telem_char(struct telem_line *l, char c)
+{
+	l->b[l->n++] = c;
+	l->sum ^= c;
+}
+
+static void telem_start(struct telem_line *l, char type)
+{
+	l->n = 1;
+	l->sum = 0;
+	l->b[0] = '$';
+	telem_char(l, type);
+	telem_char(l, ',');
+	unsigned char buf[12];
+	luint2str(buf, timer_get());
+	for (uint8_t i=0; buf[i]; i++) telem_char(l, buf[i]);
+}
+
+static void telem_num(struct telem_line *l, int32_t v)
+{
+	unsigned char buf[12];
+	telem_char(l, ',');
+	if (v < 0) {
+		telem_char(l, '-');
+		v = -v;
+	}
+	luint2str(buf, v);
+	for (uint8_t i=0; buf[i]; i++) telem_char(l, buf[i]);
+}
+
+static char telem_hex(uint8_t v)
+{
+	return v < 10 ? '0' + v : 'A' - 10 + v;
+}
+
+static void telem_end(struct telem_line *l)
+{
+	l->b[l->n++] = '*';
+	l->b[l->n++] = telem_hex(l->sum >> 4);
+	l->b[l->n++] = telem_hex(l->sum & 0xF);
+	l->b[l->n++] = '\r';
+	l->b[l->n++] = '\n';
+	uart_write(l->b, l->n);
+}
+
+/* A new read: its values (if it was good) go into v and the aggregate.
+ * Returns 1 if there are none. */
+static uint8_t telem_add(uint8_t idx, int16_t *v)
+{
+	if ((sensor_err(idx))||(sensor_get(idx, v, 1))) return 1;
+	struct telem_agg *a = &(telem_aggs[idx]);
+	for (uint8_t i=0; i < sensor_nvals(idx); i++) {
+		if ((!a->n)||(v[i] < a->min[i])) a->min[i] = v[i];
+		if ((!a->n)||(v[i] > a->max[i])) a->max[i] = v[i];
+		a->sum[i] += v[i];
+	}
+	a->n++;
+	return 0;
+}
+
+static void telem_sample(uint8_t idx, const int16_t *v, uint8_t none)
+{
+	struct telem_line l;
+	telem_start(&l, 'S');
+	telem_num(&l, idx);
+	telem_num(&l, sensor_err(idx));
+	telem_char(&l, ',');
+	telem_char(&l, sensor_quality(idx));
+	if (!none) {
+		for (uint8_t i=0; i < sensor_nvals(idx); i++) telem_num(&l, v[i]);
+	}
+	telem_end(&l);
+}
+
+static void telem_aggregate(uint8_t idx)
+{
+	struct telem_line l;
+	struct telem_agg *a = &(telem_aggs[idx]);
+	telem_start(&l, 'A');
+	telem_num(&l, idx);
+	telem_num(&l, a->n);
+	if (a->n) {
+		for (uint8_t i=0; i < sensor_nvals(idx); i++) {
+			telem_num(&l, a->min[i]);
+			telem_num(&l, a->max[i]);
+			telem_num(&l, a->sum[i] / (int16_t)a->n);
+		}
+	}
+	telem_end(&l);
+	memset(a, 0, sizeof(struct telem_agg));
+}
+
+static void telem_logstat(void)
+{
+	struct telem_line l;
+	telem_start(&l, 'L');
+	telem_num(&l, logger_sd_status());
+	telem_num(&l, logger_buf_stat());
+	telem_num(&l, logger_log_size());
+	telem_end(&l);
+}
+
+void telem_run(void)
+{
+	if (!(telem_mode & TELEM_F_ON)) return;
+	/* Nothing goes into the output of a command. The reads still count in the
+	 * aggregates, but only the latest one of each sensor gets its $S after the
+	 * task, the ones in between are dropped. The $A and $L that came due wait too. */
+	uint8_t quiet = task_busy();
+	for (uint8_t i=0; i < TELEM_SENSORS; i++) {
+		uint8_t seq = sensor_seq(i);
+		if (seq != telem_seq[i]) {
+			telem_seq[i] = seq;
+			telem_held[i] = 1 + telem_add(i, telem_v[i]);
+		}
+		if ((quiet)||(!telem_held[i])) continue;
+		telem_sample(i, telem_v[i], telem_held[i] - 1);
+		telem_held[i] = 0;
+	}
+	if (timer_get_1hzp()) {
+		if ((telem_mode & TELEM_F_AGG)&&(++telem_agg_t >= TELEM_AGG_S)) {
+			telem_agg_t = 0;
+			telem_due |= TELEM_F_AGG;
+		}
+		if ((telem_mode & TELEM_F_LOG)&&(++telem_log_t >= TELEM_LOG_S)) {
+			telem_log_t = 0;
+			telem_due |= TELEM_F_LOG;
+		}
+	}
+	if (quiet) return;
+	if (telem_due & TELEM_F_AGG) {
+		for (uint8_t i=0; i < TELEM_SENSORS; i++) telem_aggregate(i);
+	}
+	if (telem_due & TELEM_F_LOG) telem_logstat();
+	telem_due = 0;
+}
+
+CIFACE_APP(telem_cmd, "TELEM")
+{
+	if (token_count > 1) {
+		uint8_t m = TELEM_F_ON;
+		for (uint8_t i=1; i < token_count; i++) {
+			if (!strcmp_P((char*)tokenptrs[i], PSTR("OFF"))) {
+				m = 0;
+				break;
+			} else if (!strcmp_P((char*)tokenptrs[i], PSTR("AGG"))) m |= TELEM_F_AGG;
+			else if (!strcmp_P((char*)tokenptrs[i], PSTR("LOG"))) m |= TELEM_F_LOG;
+			else if (strcmp_P((char*)tokenptrs[i], PSTR("ON"))) {
+				sendstr_P(PSTR("TELEM [ON|OFF] [AGG] [LOG]"));
+				return;
+			}
+		}
+		/* Only new reads from now on, and fresh aggregates. */
+		for (uint8_t i=0; i < TELEM_SENSORS; i++) telem_seq[i] = sensor_seq(i);
+		memset(telem_aggs, 0, sizeof(telem_aggs));
+		memset(telem_held, 0, sizeof(telem_held));
+		telem_due = 0;
+		telem_agg_t = 0;
+		telem_log_t = 0;
+		telem_mode = m;
+	}
+	sendstr_P(PSTR("TELEM "));
+	sendstr_P((telem_mode & TELEM_F_ON) ? PSTR("ON") : PSTR("OFF"));
+	if (telem_mode & TELEM_F_AGG) sendstr_P(PSTR(" AGG"));
+	if (telem_mode & TELEM_F_LOG) sendstr_P(PSTR(" LOG"));
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+/* Pushes the telemetry records enabled by the TELEM command, call from the main loop. */
+void telem_run(void);
@@ -74,6 +74,10 @@ void timer_init(void) { // Timer0 is being run in PWM mode by the backlight init
 	timer_waiting=1;
 	TCCR0B = _BV(CS00);
 	TIMSK0 |= _BV(TOIE0);
+	/* Timer1 just runs free as a timestamp source for input capture (AMS2302),
+	 * the compare units are used for short sensor timeouts. */
+	TCCR1A = 0;
+	TCCR1B = _BV(ICNC1) | _BV(CS11);
 }
 
 uint8_t timer_getdec_todo(void) {
@@ -5,8 +5,8 @@
 #include "powermgmt.h"
 #include "lcd.h"
 #include "fat_config.h"
-
-#define IDLE_TIMEOUT 600
+#include "config.h"
+#include "prof.h"
 
 /* This part is the non-calendar/date/time-related part. Just uptimer, etc. */
 uint8_t timer_waiting=0;
@@ -17,6 +17,7 @@ static uint8_t timer5hz=0; // Linear 8-bit counter at 5hz, rolls over every 51s.
 static uint8_t timer5hz_todo=0; // Used to fix linear counter if a 5hz pulse is missed.
 static uint32_t timer_idle_since=0;
 static uint8_t timer_system_idle=0;
+static uint8_t timer_system_dim=0;
 
 static uint16_t timer_gen_5hzp(void) {
 	static uint8_t state=0;
@@ -35,6 +36,7 @@ static uint16_t timer_gen_5hzp(void) {
 void timer_activity(void) {
 	timer_idle_since = secondstimer;
 	timer_system_idle = 0;
+	timer_system_dim = 0;
 }
 
 void timer_delay_us(uint24_t us) {
@@ -57,6 +59,7 @@ void timer_set_waiting(void) {
 
 /* This is the interface from non-calendar time to calendar time functions. */
 static void timer_time_tick();
+static void timer_rtc_check(void);
 
 void timer_run(void) {
 	timer_1hzp=0;
@@ -68,10 +71,15 @@ void timer_run(void) {
 			timer5hz_todo = 5;
 			timer_time_tick();
 			uint32_t diff = secondstimer - timer_idle_since;
-			timer_system_idle = (diff > IDLE_TIMEOUT);
+			timer_system_idle = (diff > cfg.idle_timeout);
+			timer_system_dim = (diff > cfg.dim_timeout);
+		}
+		timer_rtc_check();
+		if (buttons_get_v()) {
+			timer_system_idle = 0;
+			timer_system_dim = 0;
 		}
-		if (buttons_get_v()) timer_system_idle = 0;
-		lcd_idle(timer_system_idle);
+		lcd_idle(timer_system_idle ? LCD_OFF : timer_system_dim ? LCD_DIM : LCD_ON);
 		timer_gen_5hzp();
 		if (timer_5hzp) {
 			timer5hz++;
@@ -81,7 +89,11 @@ void timer_run(void) {
 			timer_waiting=0;
 			break;
 		}
+		PROF_EXIT(PROF_TIMER);
+		PROF_ENTER(PROF_IDLE);
 		low_power_mode();
+		PROF_EXIT(PROF_IDLE);
+		PROF_ENTER(PROF_TIMER);
 	}
 }
 
@@ -93,6 +105,10 @@ uint32_t timer_get(void) {
 	return secondstimer;
 }
 
+uint32_t timer_get_mono_ss(void) {
+	return secondstimer*SSTC + timer_get_linear_ss_time();
+}
+
 uint8_t timer_get_1hzp(void) {
 	return timer_1hzp;
 }
@@ -109,9 +125,6 @@ uint8_t timer_get_5hz_cnt(void) {
 /* Here start the calendar time functions. */
 /*******************************************/
 
-// Time ticking without RTC is considered valid for this time.
-#define TIME_NONRTC_VALID_TIME (6*60*60)
-
 uint32_t timer_time_last_valid_moment=0;
 uint8_t timer_time_valid=0;
 static struct mtm timer_tm_now = { 0,1,1,0,0,0 };
@@ -132,10 +145,12 @@ uint8_t timer_time_isvalid(void) {
 	return timer_time_valid;
 }
 
-static void timer_time_tick(void) {
+/* The RTC is read in the background, started by the tick and checked here. */
+static void timer_rtc_check(void) {
 	uint8_t rv;
 	struct mtm rtctime;
-	if ((rv=rtc_read(&rtctime))==0) { // We have RTC and it is valid, take it as the absolute truth.
+	if ((rv=rtc_read_done(&rtctime))==RTC_BUSY) return;
+	if (rv==0) { // We have RTC and it is valid, take it as the absolute truth.
 		if ((timer_time_valid)&&(rtctime.year < timer_tm_now.year)) {
 			/* Umm, no. */
 			rv=2;
@@ -146,7 +161,14 @@ static void timer_time_tick(void) {
 			return;
 		}
 	}
-	// We have no RTC and have to wing it on our own.
+	if ((timer_time_valid)&&(rv==2)) { // RTC did exist but had no time, and our time is still valid, set RTC.
+		rtc_write(&timer_tm_now);
+	}
+}
+
+static void timer_time_tick(void) {
+	/* Wing it on our own first, if the RTC answers it will override this. */
+	rtc_read_start();
 	uint24_t tmp = timer_tm_now.sec+1;
 	if (tmp>=60) {
 		tmp = timer_tm_now.min+1;
@@ -167,10 +189,8 @@ static void timer_time_tick(void) {
 	// Time incremented. Check if it is valid and whether it should still be valid.
 	if (timer_time_valid) {
 		uint32_t passed = secondstimer - timer_time_last_valid_moment;
-		if (passed>TIME_NONRTC_VALID_TIME) timer_time_valid = 0;
-	}
-	if ((timer_time_valid)&&(rv==2)) { // RTC did exist but had no time, and our time is still valid, set RTC.
-		rtc_write(&timer_tm_now);
+		// Time ticking without RTC is considered valid for cfg.nonrtc_valid minutes.
+		if (passed > cfg.nonrtc_valid*60UL) timer_time_valid = 0;
 	}
 }
 
@@ -3,6 +3,8 @@
 
 void timer_run(void);
 uint32_t timer_get(void);
+/* Uptime in subsecond units (SSTC per second), wraps every ~19 hours. */
+uint32_t timer_get_mono_ss(void);
 uint8_t timer_get_1hzp(void);
 uint8_t timer_get_todo(void);
 uint8_t timer_get_5hzp(void);
@@ -39,3 +41,5 @@ uint16_t timer_get_lin_us(void);
 #define SSTC ((F_CPU+128)/256)
 #define FCPUKHZ ((F_CPU+500)/1000)
 #define US_PER_SSUNIT ((256000+(FCPUKHZ/2))/FCPUKHZ)
+/* Timer1 is free-running at F_CPU/8 */
+#define T1_TICKS_PER_US (F_CPU/8000000UL)
@@ -6,15 +6,19 @@
 #include "tui.h"
 #include "tui-lib.h"
 #include "rtc.h"
-#include "ams2302.h"
+#include "sensor.h"
 #include "logger.h"
 #include "fat.h"
+#include "prof.h"
+#include "config.h"
 
-#define TUI_DEFAULT_REFRESH_INTERVAL 5
+/* When a refresh changes nothing the interval is doubled, up to this. */
+#define TUI_MAX_REFRESH_INTERVAL 40
 
 static uint8_t tui_force_draw;
 static uint8_t tui_next_refresh;
-static uint8_t tui_refresh_interval=TUI_DEFAULT_REFRESH_INTERVAL; // by default 1s
+static uint8_t tui_refresh_interval; // cfg.tui_refresh by default
+static uint8_t tui_lcd_was_off;
 
 
 void tui_num_helper(unsigned char* buf, uint8_t n) {
@@ -39,10 +43,10 @@ static void tui_datetime(struct mtm* tm, uint8_t* lb) {
 
 
 static void tui_draw_mainpage(uint8_t forced) {
-	int16_t temp10;
-	uint16_t rh10;
+	int16_t v[SENSOR_MAXVALS];
 
 	uint8_t timetxt[18];
+	PROF_ENTER(PROF_OLED);
 	tui_force_draw = 0;
 	if (!forced) {
 		tui_next_refresh = timer_get_5hz_cnt()+tui_refresh_interval;
@@ -54,18 +58,21 @@ static void tui_draw_mainpage(uint8_t forced) {
 	lcd_puts(timetxt);
 
 	lcd_gotoxy(0, 2);
-	PGM_P r = ams_get(&temp10, &rh10, 5);
+	PGM_P r = sensor_get(0, v, cfg.sensor_max_age);
 	if (r) {
 		lcd_puts_dw_P(r);
 	} else {
 		unsigned char v10s[8];
 		lcd_puts_dw_P(PSTR("T: "));
-		make_v10_str(v10s, temp10);
+		make_v10_str(v10s, v[0]);
 		lcd_puts_dw(v10s);
-		lcd_puts_dw_P(PSTR("\xB0" "C RH:"));
-		make_v10_str(v10s, rh10);
-		lcd_puts_dw(v10s);
-		lcd_puts_dw_P(PSTR("%"));
+		lcd_puts_dw_P(PSTR("\xB0" "C"));
+		if (sensor_nvals(0) > 1) {
+			lcd_puts_dw_P(PSTR(" RH:"));
+			make_v10_str(v10s, v[1]);
+			lcd_puts_dw(v10s);
+			lcd_puts_dw_P(PSTR("%"));
+		}
 	}
 	lcd_clear_eol();
 
@@ -102,9 +109,160 @@ static void tui_draw_mainpage(uint8_t forced) {
 		lcd_puts_dw(timetxt);
 	}
 	lcd_clear_eol();
+	PROF_EXIT(PROF_OLED);
+}
+
+/* History graph of the first value of sensor 0: the left half has the scale and
+ * the current value, the right half one column per GRAPH_PERIOD average. There's no
+ * framebuffer, the columns are computed from the samples as they are sent. */
+#define GRAPH_N 64
+#define GRAPH_X (LCDWIDTH - GRAPH_N)
+#define GRAPH_Y 2
+#define GRAPH_PAGES (LCD_MAXY - GRAPH_Y)
+#define GRAPH_H (GRAPH_PAGES*8)
+#define GRAPH_PERIOD 60
+#define GRAPH_NONE INT16_MIN
+/* Scroll the graph with the SSD1306 one column content scroll, instead of redrawing it. */
+#define GRAPH_HWSCROLL 1
+
+static int16_t tui_graph[GRAPH_N];
+static uint8_t tui_graph_w; /* index of the oldest sample */
+static int32_t tui_graph_acc;
+static uint8_t tui_graph_acc_n;
+static uint8_t tui_graph_acc_t;
+static uint8_t tui_graph_new; /* samples not drawn yet */
+static int16_t tui_graph_min, tui_graph_max;
+
+static uint8_t tui_page;
+
+static void tui_graph_collect(void) {
+	int16_t v[SENSOR_MAXVALS];
+	if (!sensor_get(0, v, cfg.sensor_max_age)) {
+		tui_graph_acc += v[0];
+		tui_graph_acc_n++;
+	}
+	if (++tui_graph_acc_t < GRAPH_PERIOD) return;
+	int16_t a = GRAPH_NONE;
+	if (tui_graph_acc_n) a = tui_graph_acc / tui_graph_acc_n;
+	tui_graph[tui_graph_w] = a;
+	tui_graph_w = (tui_graph_w + 1) % GRAPH_N;
+	tui_graph_acc = 0;
+	tui_graph_acc_n = 0;
+	tui_graph_acc_t = 0;
+	if (tui_graph_new < GRAPH_N) tui_graph_new++;
+}
+
+/* Range of the samples rounded out to whole units, returns 1 if it changed. */
+static uint8_t tui_graph_range(void) {
+	int16_t step = sensor_scale(0) ? 10 : 1;
+	int16_t mn = INT16_MAX, mx = INT16_MIN + 1;
+	for (uint8_t i=0; i < GRAPH_N; i++) {
+		int16_t v = tui_graph[i];
+		if (v == GRAPH_NONE) continue;
+		if (v < mn) mn = v;
+		if (v > mx) mx = v;
+	}
+	if (mn > mx) {
+		mn = 0;
+		mx = step;
+	}
+	mn -= ((mn % step) + step) % step;
+	mx += (step - (((mx % step) + step) % step)) % step;
+	if (mx == mn) mx += step;
+	if ((mn == tui_graph_min) && (mx == tui_graph_max)) return 0;
+	tui_graph_min = mn;
+	tui_graph_max = mx;
+	return 1;
+}
+
+static void tui_graph_col(uint8_t i, uint8_t x) {
+	uint8_t buf[GRAPH_PAGES];
+	int16_t v = tui_graph[i];
+	uint8_t top = GRAPH_H; /* first lit row */
+	if (v != GRAPH_NONE) {
+		uint16_t h = ((int32_t)(v - tui_graph_min) * (GRAPH_H-1)) / (tui_graph_max - tui_graph_min);
+		top = (GRAPH_H-1) - h;
+	}
+	for (uint8_t p=0; p < GRAPH_PAGES; p++) {
+		uint8_t r = p*8;
+		if (top <= r) buf[p] = 0xFF;
+		else if (top >= r+8) buf[p] = 0;
+		else buf[p] = 0xFF >> (top - r);
+	}
+	lcd_gotoxy_dw(x, GRAPH_Y);
+	lcd_write_block(buf, 1, GRAPH_PAGES);
+}
+
+static void tui_graph_label(uint8_t y, int16_t v) {
+	unsigned char vs[8];
+	lcd_gotoxy_dw(0, y);
+	sensor_val_str(vs, v, sensor_scale(0));
+	uint8_t w = lcd_puts_dw(vs);
+	if (w < GRAPH_X) lcd_clear_dw(GRAPH_X - w);
+}
+
+static void tui_draw_graphpage(uint8_t forced) {
+	int16_t v[SENSOR_MAXVALS];
+	PROF_ENTER(PROF_OLED);
+	tui_force_draw = 0;
+	if (!forced) {
+		tui_next_refresh = timer_get_5hz_cnt()+tui_refresh_interval;
+	}
+	lcd_gotoxy(0,0);
+	lcd_puts_dw_P(sensor_units(0, 0));
+	lcd_puts_dw_P(PSTR(" now:"));
+	if (sensor_get(0, v, cfg.sensor_max_age)) {
+		lcd_puts_dw_P(PSTR("-"));
+	} else {
+		unsigned char vs[8];
+		sensor_val_str(vs, v[0], sensor_scale(0));
+		lcd_puts_dw(vs);
+	}
+	lcd_clear_eol();
+
+	if (tui_graph_range()) forced = 1;
+	tui_graph_label(GRAPH_Y, tui_graph_max);
+	tui_graph_label(LCD_MAXY - 2, tui_graph_min);
+	/* Only the rows between the labels, the min one is at LCD_MAXY - 2. */
+	for (uint8_t y = GRAPH_Y + 2; y < LCD_MAXY - 2; y += 2) {
+		lcd_gotoxy_dw(0, y);
+		lcd_clear_dw(GRAPH_X);
+	}
+
+	uint8_t n = tui_graph_new;
+	if ((GRAPH_HWSCROLL) && (!forced) && (n == 1)) {
+		lcd_flush();
+		ssd1306_scroll_left(GRAPH_Y, LCD_MAXY-1, GRAPH_X, LCDWIDTH-1);
+		tui_graph_col((tui_graph_w + GRAPH_N - 1) % GRAPH_N, LCDWIDTH-1);
+	} else if ((n) || (forced)) {
+		uint8_t i = tui_graph_w;
+		for (uint8_t x=GRAPH_X; x < LCDWIDTH; x++) {
+			tui_graph_col(i, x);
+			i = (i + 1) % GRAPH_N;
+		}
+	}
+	tui_graph_new = 0;
+	PROF_EXIT(PROF_OLED);
+}
+
+static void tui_draw_page(uint8_t forced) {
+	lcd_get_changes();
+	if (tui_page) tui_draw_graphpage(forced);
+	else tui_draw_mainpage(forced);
+	if (forced) return;
+	/* Back off while nothing changes, the next change brings us back to the default. */
+	lcd_flush();
+	if (lcd_get_changes()) {
+		tui_refresh_interval = cfg.tui_refresh;
+	} else if (tui_refresh_interval < TUI_MAX_REFRESH_INTERVAL) {
+		tui_refresh_interval *= 2;
+	}
+	tui_next_refresh = timer_get_5hz_cnt()+tui_refresh_interval;
 }
 
 void tui_init(void) {
+	tui_refresh_interval = cfg.tui_refresh;
+	for (uint8_t i=0; i < GRAPH_N; i++) tui_graph[i] = GRAPH_NONE;
 	lcd_clear();
 	tui_draw_mainpage(0);
 }
@@ -112,6 +270,7 @@ void tui_init(void) {
 
 void tui_run(void) {
 	uint8_t k = buttons_get();
+	if (timer_get_1hzp()) tui_graph_collect();
 #if 0
 	if ((prev_k != k)&&(k)) {
 		prev_k = k;
@@ -123,14 +282,31 @@ void tui_run(void) {
 		lcd_clear();
 		tui_force_draw = 1;
 	}
+	if ((k==BUTTON_NEXT)||(k==BUTTON_PREV)) {
+		tui_page ^= 1;
+		lcd_clear();
+		tui_force_draw = 1;
+	}
+	/* Nobody can see it, so don't draw; catch up when it comes back on. */
+	if (!lcd_is_on()) {
+		tui_lcd_was_off = 1;
+		return;
+	}
+	if (tui_lcd_was_off) {
+		tui_lcd_was_off = 0;
+		tui_refresh_interval = cfg.tui_refresh;
+		tui_force_draw = 1;
+	}
+	/* Writes were lost (or the display came back), only the missing parts get redrawn. */
+	if (lcd_get_damage()) tui_force_draw = 1;
 	if (tui_force_draw) {
-		tui_draw_mainpage(tui_force_draw);
+		tui_draw_page(tui_force_draw);
 		return;
 	} else {
 		if (timer_get_5hzp()) {
 			signed char update = (signed char)(timer_get_5hz_cnt() - tui_next_refresh);
 			if (update>=0) {
-				tui_draw_mainpage(0);
+				tui_draw_page(0);
 				return;
 			}
 		}
@@ -173,11 +349,40 @@ void tui_eject_sd(void) {
 }
 
 
+PGM_P const tui_cfg_table[] PROGMEM = {
+#define CFG(n, f, t, mi, ma) (PGM_P)cfg_n_##f,
+	CFG_ITEMS
+#undef CFG
+	(PGM_P)tui_exit_menu
+};
+
+/* Changes here are saved right away, unlike those with the CFG command. */
+const unsigned char tui_settings_name[] PROGMEM = "Settings";
+void tui_settings(void) {
+	uint8_t sel = 0;
+	for (;;) {
+		sel = tui_gen_listmenu(PSTR("SETTINGS"), tui_cfg_table, cfg_count()+1, sel);
+		if (sel >= cfg_count()) return;
+		if (cfg_type(sel) == CFG_STR) {
+			unsigned char buf[13];
+			cfg_str(sel, buf);
+			tui_gen_message_m(cfg_name(sel), buf);
+			continue;
+		}
+		uint16_t v = tui_gen_nummenu(cfg_name(sel), cfg_min(sel), cfg_max(sel), cfg_get(sel));
+		if (v != cfg_get(sel)) {
+			cfg_set(sel, v);
+			cfg_save();
+		}
+	}
+}
+
 const unsigned char tui_mm_s2[] PROGMEM = "RTC Status";
 
 PGM_P const tui_mm_table[] PROGMEM = {
     (PGM_P)tui_sdeject_name,
     (PGM_P)tui_setclock_name,
+    (PGM_P)tui_settings_name,
     (PGM_P)tui_mm_s2,
     (PGM_P)tui_exit_menu
 };
@@ -185,7 +390,7 @@ PGM_P const tui_mm_table[] PROGMEM = {
 void tui_mainmenu(void) {
 	uint8_t sel=0;
 	for (;;) {
-		sel = tui_gen_listmenu(PSTR("MAIN MENU"), tui_mm_table, 4, sel);
+		sel = tui_gen_listmenu(PSTR("MAIN MENU"), tui_mm_table, 5, sel);
 		switch (sel) {
 			case 0:
 				tui_eject_sd();
@@ -194,6 +399,9 @@ void tui_mainmenu(void) {
 				tui_set_clock();
 				return;
 			case 2:
+				tui_settings();
+				return;
+			case 3:
 				{
 					PGM_P l1 = PSTR("RTC IS");
 					if (rtc_valid()) {
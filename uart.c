@@ -15,6 +15,7 @@
 
 #include "main.h"
 #include "uart.h"
+#include "timer.h"
 
 // UART MODULE START
 typedef uint8_t urxbufoff_t;
@@ -27,17 +28,14 @@ unsigned char volatile uart_sndbuf[UARTTX_BUFLEN];
 utxbufoff_t uart_sndwptr;
 utxbufoff_t volatile uart_sndrptr;
 
-#if ((UART_BUFLEN-1) & UART_BUFLEN) == 0
-#define RLIM_RL(r) do { r &= (UART_BUFLEN-1); } while(0)
-#else
-#define RLIM_RL(r) do { if (r>=UART_BUFLEN) r=0; } while(0)
+#if (((UART_BUFLEN-1) & UART_BUFLEN) != 0) || (UART_BUFLEN > 256)
+#error "UART_BUFLEN must be a power of two, at most 256"
 #endif
-
-#if ((UARTTX_BUFLEN-1) & UARTTX_BUFLEN) == 0
-#define RLIM_TL(r) do { r &= (UARTTX_BUFLEN-1); } while(0)
-#else
-#define RLIM_TL(r) do { if (r>=UARTTX_BUFLEN) r=0; } while(0)
+#if (((UARTTX_BUFLEN-1) & UARTTX_BUFLEN) != 0) || (UARTTX_BUFLEN > 256)
+#error "UARTTX_BUFLEN must be a power of two, at most 256"
 #endif
+#define RLIM_RL(r) do { r &= (UART_BUFLEN-1); } while(0)
+#define RLIM_TL(r) do { r &= (UARTTX_BUFLEN-1); } while(0)
 
 #if (defined __AVR_ATmega328P__)||(defined __AVR_ATmega328__)||(defined __AVR_ATmega168P__)||(defined __AVR_ATmega168__)||(__AVR_ATmega88P__)||(__AVR_ATmega88__)||(defined __AVR_ATmega48P__)||(defined __AVR_ATmega48__)
 #define RX_ISR USART_RX_vect
@@ -50,7 +48,15 @@ utxbufoff_t volatile uart_sndrptr;
 
 extern uint8_t timer_waiting;
 
+static uint16_t uart_rx_errs;
+
 ISR(RX_ISR) {
+	/* Bytes with a framing error (somebody talking at another rate) are dropped. */
+	if (UCSR0A & _BV(FE0)) {
+		(void)UDR0;
+		uart_rx_errs++;
+		return;
+	}
 	urxbufoff_t reg = uart_rcvwptr;
 	uart_rcvbuf[reg++] = UDR0;
 	RLIM_RL(reg);
@@ -141,6 +147,50 @@ void uart_send(unsigned char val) {
 	sei();
 }
 
+/* Free space in the transmit ring, one slot is kept empty. */
+static inline utxbufoff_t uart_tx_free(void) {
+	return (utxbufoff_t)(uart_sndrptr - uart_sndwptr - 1) & (UARTTX_BUFLEN-1);
+}
+
+/* Publish the copied bytes and make sure the ISR is sending them. */
+static inline void uart_tx_commit(utxbufoff_t w) {
+	cli();
+	uart_sndwptr = w;
+	UCSR0B |= _BV(5);
+	sei();
+}
+
+void uart_write(const void *buf, uint16_t len) {
+	const uint8_t *p = buf;
+	while (len) {
+		utxbufoff_t n;
+		while (!(n = uart_tx_free()));
+		if (n > len) n = len;
+		len -= n;
+		utxbufoff_t w = uart_sndwptr;
+		do {
+			uart_sndbuf[w++] = *p++;
+			RLIM_TL(w);
+		} while (--n);
+		uart_tx_commit(w);
+	}
+}
+
+void uart_write_P(PGM_P buf, uint16_t len) {
+	while (len) {
+		utxbufoff_t n;
+		while (!(n = uart_tx_free()));
+		if (n > len) n = len;
+		len -= n;
+		utxbufoff_t w = uart_sndwptr;
+		do {
+			uart_sndbuf[w++] = pgm_read_byte(buf++);
+			RLIM_TL(w);
+		} while (--n);
+		uart_tx_commit(w);
+	}
+}
+
 void uart_init(void) {
 	cli();
 
@@ -164,3 +214,152 @@ void uart_init(void) {
 void uart_wait_txdone(void) {
 	while (uart_sndwptr != uart_sndrptr);
 }
+
+static uint32_t uart_baud = BAUD;
+
+uint32_t uart_get_baud(void) {
+	return uart_baud;
+}
+
+/* The U2X divider for baud, 0 if it can't be made within 2%. */
+static uint16_t uart_baud_div(uint32_t baud) {
+	if (!baud) return 0;
+	uint32_t div = ((F_CPU/8) + (baud/2)) / baud;
+	if ((!div)||(div > 4096)) return 0;
+	uint32_t real = (F_CPU/8) / div;
+	uint32_t err = real > baud ? real - baud : baud - real;
+	if (err > baud/50) return 0;
+	return div;
+}
+
+uint8_t uart_baud_ok(uint32_t baud) {
+	return uart_baud_div(baud) != 0;
+}
+
+/* Switch the rate (always with U2X), after the queued bytes have gone out at the old one.
+ * Returns 1 if the rate isn't possible, see uart_baud_ok. */
+uint8_t uart_set_baud(uint32_t baud) {
+	uint16_t div = uart_baud_div(baud);
+	if (!div) return 1;
+	uart_wait_txdone();
+	while (!(UCSR0A & _BV(UDRE0)));
+	/* The last byte is still in the shift register, give it two character times. */
+	uint16_t ubrr = UBRR0;
+	uint8_t sh = (UCSR0A & _BV(U2X0)) ? 3 : 4;
+	uint32_t us = ((((uint32_t)ubrr + 1) << sh) * 20) / (F_CPU/1000000UL);
+	while (us > 100000) {
+		timer_delay_us(100000);
+		us -= 100000;
+	}
+	timer_delay_us(us);
+	UBRR0 = div - 1;
+	UCSR0A |= _BV(U2X0);
+	uart_baud = baud;
+	return 0;
+}
+
+uint16_t uart_rx_errors(void) {
+	return uart_rx_errs;
+}
+
+/* A byte, or -1 if none came in ms. */
+int16_t uart_recv_timeout(uint16_t ms) {
+	for (;;) {
+		if (uart_isdata()) return uart_recv();
+		if (!ms--) return -1;
+		timer_delay_ms(1);
+	}
+}
+
+/* The rates the auto-baud can pick. The edges are timestamped by the pin change
+ * interrupt, a few us late behind the other ISRs; that stays within the 5% only up
+ * to 115200 (a bit is 17 Timer1 ticks there), so the faster rates need BAUD <rate>. */
+static const uint32_t uart_std_bauds[] PROGMEM = {
+	9600, 14400, 19200, 28800, 38400, 57600, 76800, 115200
+};
+
+/* A 'U' (0x55) from the host has 10 edges a bit time apart, from the falling edge of
+ * the start bit to the rising edge of the stop bit. */
+#define AB_EDGES 10
+
+static volatile uint8_t ab_n = AB_EDGES; /* edges in ab_t, full when not armed */
+static uint8_t ab_lvl; /* RXD after the last edge */
+static uint16_t ab_t[AB_EDGES];
+static uint8_t ab_seen; /* ab_n at the last poll */
+
+/* From the PCINT2 ISR (in ams2302.c, which shares it) with TCNT1. */
+void uart_ab_edge(uint16_t t) {
+	uint8_t n = ab_n;
+	if (n >= AB_EDGES) return;
+	uint8_t p = PIND & _BV(0);
+	if (p == ab_lvl) return; /* another pin on the port */
+	ab_lvl = p;
+	ab_t[n] = t;
+	ab_n = n + 1;
+}
+
+/* Wait for the line to go down from idle. */
+static void uart_ab_arm(void) {
+	cli();
+	ab_n = 0;
+	ab_lvl = _BV(0);
+	sei();
+	ab_seen = 0;
+}
+
+/* Starts timing RXD in the background for uart_autobaud_poll, the receiver is off
+ * meanwhile. uart_autobaud_stop turns it back on. */
+void uart_autobaud_start(void) {
+	UCSR0B &= ~_BV(RXEN0); /* RXD is a plain input while we look at it */
+	uart_ab_arm();
+	PCMSK2 |= _BV(PCINT16);
+	PCIFR = _BV(PCIF2);
+	PCICR |= _BV(PCIE2);
+}
+
+void uart_autobaud_stop(void) {
+	cli();
+	PCMSK2 &= ~_BV(PCINT16);
+	if (!PCMSK2) PCICR &= ~_BV(PCIE2);
+	ab_n = AB_EDGES;
+	sei();
+	UCSR0B |= _BV(RXEN0);
+}
+
+/* Timer1 has to keep running for the timestamps. */
+uint8_t uart_autobaud_busy(void) {
+	return !!(PCMSK2 & _BV(PCINT16));
+}
+
+/* The rate of the 'U' the host sent (within 5% of a standard one), or 0 if there is
+ * none yet. Anything else gets thrown away and the wait goes on; a partial one that
+ * did not move since the last poll was not a 'U' either. */
+uint32_t uart_autobaud_poll(void) {
+	uint8_t n = ab_n;
+	if (n < AB_EDGES) {
+		if ((n)&&(n == ab_seen)) uart_ab_arm();
+		else ab_seen = n;
+		return 0;
+	}
+	uint32_t rv = 0;
+	uint16_t total = ab_t[AB_EDGES-1] - ab_t[0];
+	uint16_t bit = total / (AB_EDGES-1);
+	if (!bit) goto out;
+	/* Each edge about a bit time from the last, which a different character is not. */
+	for (uint8_t i=1; i < AB_EDGES; i++) {
+		uint16_t d = ab_t[i] - ab_t[i-1];
+		if ((d < bit/2)||(d > bit*2)) goto out;
+	}
+	uint32_t baud = ((AB_EDGES-1) * T1_TICKS_PER_US * 1000000UL) / total;
+	for (uint8_t i=0; i < sizeof(uart_std_bauds)/sizeof(uart_std_bauds[0]); i++) {
+		uint32_t std = pgm_read_dword(&(uart_std_bauds[i]));
+		uint32_t err = std > baud ? std - baud : baud - std;
+		if (err < std/20) {
+			rv = std;
+			break;
+		}
+	}
+out:
+	if (!rv) uart_ab_arm();
+	return rv;
+}
@@ -19,10 +19,29 @@ void uart_send(unsigned char val);
 void uart_init(void);
 uint8_t uart_peek(void);
 void uart_wait_txdone(void);
+uint8_t uart_baud_ok(uint32_t baud);
+uint8_t uart_set_baud(uint32_t baud);
+uint32_t uart_get_baud(void);
+uint16_t uart_rx_errors(void);
+int16_t uart_recv_timeout(uint16_t ms);
+void uart_autobaud_start(void);
+uint32_t uart_autobaud_poll(void);
+void uart_autobaud_stop(void);
+uint8_t uart_autobaud_busy(void);
+void uart_ab_edge(uint16_t t); /* PCINT2 */
 #define BAUD 9600
 #define RECEIVE() uart_recv()
 #define SEND(n) uart_send(n)
 #define PEEK() uart_peek()
-#define UART_BUFLEN 16
-#define UARTTX_BUFLEN 16
+/* Ring sizes, powers of two up to 256, the Makefile can override these. */
+#ifndef UART_BUFLEN
+#define UART_BUFLEN 32
+#endif
+#ifndef UARTTX_BUFLEN
+#define UARTTX_BUFLEN 64
+#endif
+
+/* Queue len bytes, from RAM or flash, copied into the ring as much at a time as fits. */
+void uart_write(const void *buf, uint16_t len);
+void uart_write_P(PGM_P buf, uint16_t len);
 